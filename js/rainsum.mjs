@@ -321,6 +321,12 @@ async function handleMode(mode, algorithm, seed, inputPath, outputPath, size, ar
         key = Buffer.from(password, 'utf8');
       }
 
+      // Chunked stream files (cipher mode 0x12, written by the C++ stream-enc)
+      // postdate the checked-in rain.wasm, which cannot parse them.
+      if (buffer.length > 5 && buffer[5] === 0x12) {
+        throw new Error("[dec] Chunked stream files (cipher mode 0x12) are not supported by the JS build; decrypt with the C++ rainsum.");
+      }
+
       // --- HMAC Verification Step ---
       // Get header info (as JSON) from the encrypted file.
       const headerInfoStr = await getFileHeaderInfo(buffer);
@@ -385,6 +391,9 @@ async function handleMode(mode, algorithm, seed, inputPath, outputPath, size, ar
           console.log(`[dec] No block cipher header found, using stream decryption.`);
         }
       }
+      if (!decryptedBuffer) {
+        throw new Error("[dec] Decryption failed.");
+      }
       fs.writeFileSync(outputPath, decryptedBuffer);
       if (verbose) {
         console.log(`[dec] Decrypted data written to: ${outputPath}`);
@@ -60,10 +60,14 @@ function encrypt() {
     success=False
   fi
 
-  ./js/rainsum.mjs -m dec $keyArg test-file.src.rc.cpp &>> test.log
-  if ! diff test-file.src test-file.src.rc.cpp.dec &>> test.log; then
-    echo "CPP encrypt (JS decrypt) failed" >&2
-    success=False
+  # The JS build cannot read chunked stream files (cipher mode 0x12)
+  if [[ "$mode" != "stream-enc" ]]; then
+    rm -f test-file.src.rc.cpp.dec
+    ./js/rainsum.mjs -m dec $keyArg test-file.src.rc.cpp &>> test.log
+    if ! diff test-file.src test-file.src.rc.cpp.dec &>> test.log; then
+      echo "CPP encrypt (JS decrypt) failed" >&2
+      success=False
+    fi
   fi
 
   if $success; then
@@ -102,6 +106,189 @@ function generate_test_file() {
   head -c 1024 /dev/urandom >> $test_file
 }
 
+# Expect a command to fail; $1 names the case, the rest is the command.
+function expect_failure() {
+  local name=$1
+  shift
+  if "$@" &>> test.log; then
+    echo "$name: expected failure, but it succeeded" >&2
+    exit 1
+  fi
+}
+
+# stream-enc - / dec - through pipes (per-chunk tags), including tampered streams.
+function test_stream_pipe() {
+  local key="pipe-$RANDOM"
+  local profile
+
+  echo "Testing: stream-enc - / dec - through pipes"
+  echo "Testing: stream-enc - / dec - through pipes" &>> test.log
+  rm -f test-file.src.pipe* &>> test.log
+  head -c 3000000 /dev/urandom > test-file.src.pipe
+
+  for profile in kdf xof; do
+    # Input on stdin, ciphertext on stdout; then back the other way into a file
+    cat test-file.src.pipe | ./rainsum -m stream-enc --password $key --keystream $profile - > test-file.src.pipe.rc 2>> test.log
+    cat test-file.src.pipe.rc | ./rainsum -m dec --password $key -o test-file.src.pipe.dec - &>> test.log
+    if ! cmp test-file.src.pipe test-file.src.pipe.dec &>> test.log; then
+      echo "Pipe round trip failed (keystream $profile)" >&2
+      exit 1
+    fi
+    rm -f test-file.src.pipe.dec
+  done
+
+  # Truncated streams: the end frame (and its tag) or half of the file is missing
+  local size=$(wc -c < test-file.src.pipe.rc)
+  head -c $((size - 36)) test-file.src.pipe.rc > test-file.src.pipe.cut
+  expect_failure "Pipe dec of a stream without its end frame" \
+    ./rainsum -m dec --password $key -o test-file.src.pipe.dec - < test-file.src.pipe.cut
+  head -c $((size / 2)) test-file.src.pipe.rc > test-file.src.pipe.cut
+  expect_failure "Pipe dec of a half stream" \
+    ./rainsum -m dec --password $key -o test-file.src.pipe.dec - < test-file.src.pipe.cut
+
+  # Reordered chunks: chunks of zeros all compress to the same frame length, so the
+  # frame size (and header size) follow from the 1- and 2-chunk ciphertext sizes
+  local n
+  for n in 1 2 3; do
+    head -c $((n * 1048576)) /dev/zero | ./rainsum -m stream-enc --password $key --seed 7 --salt pipe -o test-file.src.pipe.z$n - &>> test.log
+  done
+  local size1=$(wc -c < test-file.src.pipe.z1)
+  local size2=$(wc -c < test-file.src.pipe.z2)
+  local frame=$((size2 - size1))
+  local header=$((size1 - frame - 36))
+  {
+    head -c $header test-file.src.pipe.z3
+    tail -c +$((header + frame + 1)) test-file.src.pipe.z3 | head -c $frame
+    tail -c +$((header + 1)) test-file.src.pipe.z3 | head -c $frame
+    tail -c +$((header + 2 * frame + 1)) test-file.src.pipe.z3
+  } > test-file.src.pipe.swapped
+  head -c $((3 * 1048576)) /dev/zero > test-file.src.pipe.zeros
+  ./rainsum -m dec --password $key -o test-file.src.pipe.dec - < test-file.src.pipe.z3 &>> test.log
+  if ! cmp test-file.src.pipe.zeros test-file.src.pipe.dec &>> test.log; then
+    echo "Pipe round trip of zeros failed" >&2
+    exit 1
+  fi
+  expect_failure "Pipe dec with chunks 0 and 1 swapped" \
+    ./rainsum -m dec --password $key -o test-file.src.pipe.dec - < test-file.src.pipe.swapped
+
+  rm -f test-file.src.pipe*
+}
+
+# File-based stream-enc with the xof keystream profile.
+function test_stream_xof() {
+  local key="xof-$RANDOM"
+
+  echo "Testing: stream-enc --keystream xof"
+  echo "Testing: stream-enc --keystream xof" &>> test.log
+  rm -f test-file.src.xof* &>> test.log
+  head -c 2500000 /dev/urandom > test-file.src.xof
+  ./rainsum -m stream-enc --password $key --keystream xof test-file.src.xof &>> test.log
+  ./rainsum -m dec --password $key test-file.src.xof.rc &>> test.log
+  if ! cmp test-file.src.xof test-file.src.xof.rc.dec &>> test.log; then
+    echo "xof round trip failed" >&2
+    exit 1
+  fi
+  rm -f test-file.src.xof.rc.dec
+  expect_failure "xof dec with the wrong password" \
+    ./rainsum -m dec --password "wrong-$key" test-file.src.xof.rc
+
+  rm -f test-file.src.xof*
+}
+
+# Invert the byte at offset $2 of file $1 in place.
+function flip_byte() {
+  local file=$1
+  local offset=$2
+  local old=$(od -An -tu1 -j $offset -N1 "$file" | tr -d ' ')
+  printf "\\$(printf %03o $((255 - old)))" | dd of="$file" bs=1 seek=$offset count=1 conv=notrunc status=none
+}
+
+# dec --range A-B of $1 must equal plaintext $2 bytes A..B (B empty: to the end).
+function check_range() {
+  local cipher=$1
+  local plain=$2
+  local first=$3
+  local last=$4
+  rm -f "$cipher.dec"
+  ./rainsum -m dec --password $key --range "$first-$last" "$cipher" &>> test.log
+  if [[ -z "$last" ]]; then
+    tail -c +$((first + 1)) "$plain" > "$plain.slice"
+  else
+    tail -c +$((first + 1)) "$plain" | head -c $((last - first + 1)) > "$plain.slice"
+  fi
+  if ! cmp "$plain.slice" "$cipher.dec" &>> test.log; then
+    echo "dec --range $first-$last does not match the plaintext" >&2
+    exit 1
+  fi
+}
+
+# Segment index: dec --range slices, --no-index files, and corrupted index entries / chunks.
+function test_stream_range() {
+  local key="range-$RANDOM"
+
+  echo "Testing: stream-enc segment index and dec --range"
+  echo "Testing: stream-enc segment index and dec --range" &>> test.log
+  rm -f test-file.src.idx* test-file.src.noidx* &>> test.log
+  { head -c 2200000 /dev/urandom; head -c 1200000 /dev/zero; } > test-file.src.idx
+  local size=$(wc -c < test-file.src.idx)
+
+  ./rainsum -m stream-enc --password $key test-file.src.idx &>> test.log
+  check_range test-file.src.idx.rc test-file.src.idx 0 0
+  check_range test-file.src.idx.rc test-file.src.idx 1000 2000
+  check_range test-file.src.idx.rc test-file.src.idx 1048570 1048590
+  check_range test-file.src.idx.rc test-file.src.idx 1000000 3200000
+  check_range test-file.src.idx.rc test-file.src.idx 2000000 ""
+  check_range test-file.src.idx.rc test-file.src.idx $((size - 1)) $((size + 5000))
+  expect_failure "dec --range starting past the end" \
+    ./rainsum -m dec --password $key --range "$size-" test-file.src.idx.rc
+
+  # --no-index: full dec still works, --range does not
+  cp test-file.src.idx test-file.src.noidx
+  ./rainsum -m stream-enc --password $key --no-index test-file.src.noidx &>> test.log
+  ./rainsum -m dec --password $key test-file.src.noidx.rc &>> test.log
+  if ! cmp test-file.src.noidx test-file.src.noidx.rc.dec &>> test.log; then
+    echo "--no-index round trip failed" >&2
+    exit 1
+  fi
+  expect_failure "dec --range of a --no-index file" \
+    ./rainsum -m dec --password $key --range 0-10 test-file.src.noidx.rc
+
+  # The file tag (the last 32 bytes of a --no-index file) covers every chunk
+  rm -f test-file.src.noidx.rc.dec
+  flip_byte test-file.src.noidx.rc $(($(wc -c < test-file.src.noidx.rc) - 1))
+  expect_failure "Full dec with a corrupted file tag" \
+    ./rainsum -m dec --password $key test-file.src.noidx.rc
+  if [[ -e test-file.src.noidx.rc.dec ]]; then
+    echo "dec left output behind after a failed file tag" >&2
+    exit 1
+  fi
+
+  # A corrupted index entry (the last entry's tag, just before the 48-byte trailer)
+  local csize=$(wc -c < test-file.src.idx.rc)
+  cp test-file.src.idx.rc test-file.src.idx.bad.rc
+  flip_byte test-file.src.idx.bad.rc $((csize - 49))
+  rm -f test-file.src.idx.bad.rc.dec
+  expect_failure "dec --range with a corrupted index entry" \
+    ./rainsum -m dec --password $key --range 0-10 test-file.src.idx.bad.rc
+
+  # A corrupted byte in chunk 1: ranges inside chunk 0 still verify, ranges reaching
+  # chunk 1 fail and leave no output behind
+  cp test-file.src.idx.rc test-file.src.idx.bad.rc
+  flip_byte test-file.src.idx.bad.rc 1500000
+  check_range test-file.src.idx.bad.rc test-file.src.idx 0 1000
+  rm -f test-file.src.idx.bad.rc.dec
+  expect_failure "dec --range over a corrupted chunk" \
+    ./rainsum -m dec --password $key --range 0-1500000 test-file.src.idx.bad.rc
+  if [[ -e test-file.src.idx.bad.rc.dec ]]; then
+    echo "dec --range left output behind after a failed chunk tag" >&2
+    exit 1
+  fi
+  expect_failure "Full dec of a file with a corrupted chunk" \
+    ./rainsum -m dec --password $key test-file.src.idx.bad.rc
+
+  rm -f test-file.src.idx* test-file.src.noidx*
+}
+
 # Nested loop harness.
 function test_harness() {
   local mode block_size nonce_size output_extension search_mode deterministic_nonce entropy_mode
@@ -246,6 +433,9 @@ function test_harness() {
   done
 }
 
-# Run the test harness.
+# Run the stream cipher CLI cases, then the test harness.
+test_stream_pipe
+test_stream_xof
+test_stream_range
 test_harness
 
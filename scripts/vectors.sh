@@ -6,6 +6,8 @@ echo "Rainbow test vectors:"
 ./rainsum --test-vectors -a rainbow -s 256
 echo "Rainstorm test vectors:"
 ./rainsum --test-vectors -a rainstorm -s 256
+echo "Rainstorm tree (RainTree v1) test vectors:"
+./rainsum --test-vectors --tree -a rainstorm -s 256
 echo "JavaScript/WASM test vectors"
 echo "Rainbow test vectors:"
 ./js/rainsum.mjs --test-vectors -a rainbow -s 256
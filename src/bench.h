@@ -0,0 +1,242 @@
+#pragma once
+// rainsum --bench: in-process hash speed test in the style of SMHasher's speed tests.
+// Bulk: cycles/byte and GB/s for every (algorithm, size) HashEngine from empty input up to
+// 64 MiB. Small keys: latency of one call for 1-64 byte keys, each call's input depending on
+// the previous output so calls cannot overlap. Cycles are TSC ticks (x86 only, as SMHasher
+// reports them); elsewhere only wall-clock figures are given.
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define RAIN_BENCH_TSC 1
+#endif
+
+#include "tool.h"
+
+namespace bench {
+  static inline uint64_t ticks() {
+#if defined(RAIN_BENCH_TSC)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  struct Sample {
+    double ns = 0;     // per hash
+    double cycles = 0; // per hash (0 without a TSC)
+  };
+
+  // One timed (hash, input length) pair, for both the bulk and small-key tables
+  struct Row {
+    HashEngine engine;
+    size_t length;
+    Sample sample;
+  };
+
+  static const std::vector<size_t> BULK_LENGTHS = {
+    0, 16, 64, 256, 1024, 4096, 65536, 1 << 20, 16 << 20, 64 << 20
+  };
+  static const std::vector<size_t> SMALL_LENGTHS = {
+    1, 2, 3, 4, 7, 8, 15, 16, 17, 24, 31, 32, 33, 48, 63, 64
+  };
+  static constexpr size_t SMALL_MAX = 64;
+
+  // Every (algorithm, size) the hash engine table knows, optionally narrowed by -a / -s
+  static std::vector<HashEngine> engines(HashAlgorithm onlyAlgot, uint32_t onlyBits) {
+    static const std::pair<HashAlgorithm, uint32_t> all[] = {
+      { HashAlgorithm::Rainbow, 64 }, { HashAlgorithm::Rainbow, 128 }, { HashAlgorithm::Rainbow, 256 },
+      { HashAlgorithm::Rainstorm, 64 }, { HashAlgorithm::Rainstorm, 128 },
+      { HashAlgorithm::Rainstorm, 256 }, { HashAlgorithm::Rainstorm, 512 },
+    };
+    std::vector<HashEngine> out;
+    for (const auto& [algot, bits] : all) {
+      if ((onlyAlgot == HashAlgorithm::Unknown || onlyAlgot == algot) && (onlyBits == 0 || onlyBits == bits)) {
+        out.push_back(HashEngine::resolve<bswap>(algot, bits));
+      }
+    }
+    if (out.empty()) {
+      throw std::runtime_error("No hash matches the requested --bench algorithm and size.");
+    }
+    return out;
+  }
+
+  // Throughput: independent calls back to back, best of several trials of ~10 ms each
+  static Sample timeBulk(const HashEngine& engine, const uint8_t* data, size_t len) {
+    uint8_t out[64];
+    // Calibrate the calls per trial from one warm-up call
+    auto t0 = std::chrono::steady_clock::now();
+    engine(data, len, 0, out);
+    double once = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    size_t calls = std::max<size_t>(1, (size_t)(10e6 / std::max(once, 1.0)));
+    int trials = len >= (16 << 20) ? 3 : 5;
+
+    Sample best;
+    for (int t = 0; t < trials; t++) {
+      auto start = std::chrono::steady_clock::now();
+      uint64_t c0 = ticks();
+      for (size_t i = 0; i < calls; i++) {
+        engine(data, len, i, out);
+      }
+      uint64_t c1 = ticks();
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      if (t == 0 || ns / calls < best.ns) {
+        best.ns = ns / calls;
+        best.cycles = (double)(c1 - c0) / calls;
+      }
+    }
+    return best;
+  }
+
+  // Latency: each call's key starts with a byte of the previous digest
+  static Sample timeSmall(const HashEngine& engine, uint8_t* key, size_t len) {
+    uint8_t out[64] = { 0 };
+    const size_t calls = 20000;
+    Sample best;
+    for (int t = 0; t < 5; t++) {
+      auto start = std::chrono::steady_clock::now();
+      uint64_t c0 = ticks();
+      for (size_t i = 0; i < calls; i++) {
+        key[0] ^= out[0];
+        engine(key, len, 0, out);
+      }
+      uint64_t c1 = ticks();
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      if (t == 0 || ns / calls < best.ns) {
+        best.ns = ns / calls;
+        best.cycles = (double)(c1 - c0) / calls;
+      }
+    }
+    return best;
+  }
+
+  static std::string lengthLabel(size_t len) {
+    if (len >= (1 << 20) && len % (1 << 20) == 0) return std::to_string(len >> 20) + " MiB";
+    if (len >= 1024 && len % 1024 == 0) return std::to_string(len >> 10) + " KiB";
+    return std::to_string(len) + " B";
+  }
+
+  static std::string engineLabel(const HashEngine& engine) {
+    return hashAlgoToString(engine.algot) + "-" + std::to_string(engine.bits);
+  }
+
+  static void printTable(std::ostream& os, const std::vector<Row>& bulk, const std::vector<Row>& small,
+                         const std::vector<HashEngine>& list) {
+    const bool tsc = ticks() != 0;
+    os << "rainsum " << VERSION << " benchmark (kernel: " << simdKernelName(activeSimdKernel())
+       << ", cycles: " << (tsc ? "TSC" : "unavailable") << ")\n\n";
+
+    os << "Bulk speed\n";
+    os << std::left << std::setw(16) << "hash" << std::right << std::setw(10) << "input"
+       << std::setw(14) << "cycles/hash" << std::setw(14) << "cycles/byte" << std::setw(10) << "GB/s" << "\n";
+    for (const Row& row : bulk) {
+      os << std::left << std::setw(16) << engineLabel(row.engine) << std::right
+         << std::setw(10) << lengthLabel(row.length) << std::fixed << std::setprecision(2);
+      os << std::setw(14);
+      if (tsc) os << row.sample.cycles; else os << "-";
+      os << std::setw(14);
+      if (tsc && row.length > 0) os << row.sample.cycles / row.length; else os << "-";
+      os << std::setw(10);
+      if (row.length > 0) os << row.length / row.sample.ns; else os << "-";
+      os << "\n";
+    }
+
+    os << "\nSmall key latency (" << (tsc ? "cycles" : "ns") << "/hash)\n";
+    os << std::left << std::setw(8) << "key";
+    for (const HashEngine& engine : list) {
+      os << std::right << std::setw(15) << engineLabel(engine);
+    }
+    os << "\n";
+    auto cell = [&](const Sample& s) { return tsc ? s.cycles : s.ns; };
+    std::vector<double> sum(list.size(), 0);
+    for (size_t len = 1; len <= SMALL_MAX; len++) {
+      bool shown = std::find(SMALL_LENGTHS.begin(), SMALL_LENGTHS.end(), len) != SMALL_LENGTHS.end();
+      if (shown) os << std::left << std::setw(8) << lengthLabel(len);
+      for (size_t e = 0; e < list.size(); e++) {
+        const Sample& s = small[(len - 1) * list.size() + e].sample;
+        sum[e] += cell(s);
+        if (shown) os << std::right << std::setw(15) << std::fixed << std::setprecision(1) << cell(s);
+      }
+      if (shown) os << "\n";
+    }
+    os << std::left << std::setw(8) << "avg";
+    for (size_t e = 0; e < list.size(); e++) {
+      os << std::right << std::setw(15) << std::fixed << std::setprecision(1) << sum[e] / SMALL_MAX;
+    }
+    os << "\n  (avg over every key length 1-" << SMALL_MAX << ")\n";
+  }
+
+  static void printJson(std::ostream& os, const std::vector<Row>& bulk, const std::vector<Row>& small) {
+    const bool tsc = ticks() != 0;
+    auto num = [](double v) {
+      std::ostringstream s;
+      s << std::fixed << std::setprecision(3) << v;
+      return s.str();
+    };
+    os << "{\n  \"version\": \"" << VERSION << "\",\n"
+       << "  \"kernel\": \"" << simdKernelName(activeSimdKernel()) << "\",\n"
+       << "  \"cycles\": " << (tsc ? "\"tsc\"" : "null") << ",\n"
+       << "  \"bulk\": [\n";
+    for (size_t i = 0; i < bulk.size(); i++) {
+      const Row& row = bulk[i];
+      os << "    {\"algorithm\": \"" << hashAlgoToString(row.engine.algot) << "\", \"bits\": " << row.engine.bits
+         << ", \"length\": " << row.length
+         << ", \"nsPerHash\": " << num(row.sample.ns)
+         << ", \"cyclesPerHash\": " << (tsc ? num(row.sample.cycles) : "null")
+         << ", \"cyclesPerByte\": " << (tsc && row.length ? num(row.sample.cycles / row.length) : "null")
+         << ", \"gbPerSec\": " << (row.length ? num(row.length / row.sample.ns) : "null")
+         << "}" << (i + 1 < bulk.size() ? "," : "") << "\n";
+    }
+    os << "  ],\n  \"small\": [\n";
+    for (size_t i = 0; i < small.size(); i++) {
+      const Row& row = small[i];
+      os << "    {\"algorithm\": \"" << hashAlgoToString(row.engine.algot) << "\", \"bits\": " << row.engine.bits
+         << ", \"length\": " << row.length
+         << ", \"nsPerHash\": " << num(row.sample.ns)
+         << ", \"cyclesPerHash\": " << (tsc ? num(row.sample.cycles) : "null")
+         << "}" << (i + 1 < small.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+  }
+
+  // Run both tests for the selected hashes and print them as "table" or "json"
+  static void run(HashAlgorithm onlyAlgot, uint32_t onlyBits, const std::string& format, std::ostream& os) {
+    if (format != "table" && format != "json") {
+      throw std::runtime_error("Invalid --bench-format: " + format + " (must be table or json)");
+    }
+    const std::vector<HashEngine> list = engines(onlyAlgot, onlyBits);
+
+    std::vector<uint8_t> data(BULK_LENGTHS.back());
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    std::vector<Row> bulk;
+    for (const HashEngine& engine : list) {
+      for (size_t len : BULK_LENGTHS) {
+        bulk.push_back({ engine, len, timeBulk(engine, data.data(), len) });
+      }
+    }
+
+    std::vector<Row> small;
+    uint8_t key[SMALL_MAX];
+    for (size_t len = 1; len <= SMALL_MAX; len++) {
+      for (const HashEngine& engine : list) {
+        std::copy(data.begin(), data.begin() + SMALL_MAX, key);
+        small.push_back({ engine, len, timeSmall(engine, key, len) });
+      }
+    }
+
+    if (format == "json") {
+      printJson(os, bulk, small);
+    } else {
+      printTable(os, bulk, small, list);
+    }
+  }
+}
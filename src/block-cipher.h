@@ -1,3 +1,4 @@
+#include "scatter-matcher.h"
 #include "parallel-scatter.h"
 
 /**
@@ -46,7 +47,8 @@
 */
 
 static std::vector<uint8_t> puzzleEncryptBufferWithHeader(
-  const std::vector<uint8_t> &plainData,
+  const uint8_t *plainData,
+  size_t plainSize,
   std::vector<uint8_t> key,
   HashAlgorithm algot,
   uint32_t hash_size,
@@ -65,7 +67,7 @@ static std::vector<uint8_t> puzzleEncryptBufferWithHeader(
 #endif
 
   // Compress plaintext
-  auto compressed = compressData(plainData);
+  auto compressed = compressData(plainData, plainSize);
 
   // Prepare FileHeader
   FileHeader hdr{};
@@ -96,18 +98,21 @@ static std::vector<uint8_t> puzzleEncryptBufferWithHeader(
   // Serialize FileHeader
   std::vector<uint8_t> headerData = serializeFileHeader(hdr);
 
+  // Resolve the hash once for every call below
+  const HashEngine engine = HashEngine::resolve<bswap>(algot, hash_size);
+
   // Derive PRK
   std::vector<uint8_t> seed_vec(8);
   for (size_t i = 0; i < 8; ++i) {
     seed_vec[i] = static_cast<uint8_t>((seed >> (i * 8)) & 0xFF);
   }
-  std::vector<uint8_t> prk = derivePRK(seed_vec, salt, key, algot, hash_size);
+  std::vector<uint8_t> prk = derivePRK(seed_vec, salt, key, engine);
 
   // Extend PRK into subkeys
   size_t totalBlocks = (hdr.originalSize + blockSize - 1) / blockSize;
   size_t subkeySize = hdr.hashSizeBits / 8;
   size_t totalNeeded = totalBlocks * subkeySize;
-  std::vector<uint8_t> allSubkeys = extendOutputKDF(prk, totalNeeded, algot, hdr.hashSizeBits);
+  std::vector<uint8_t> allSubkeys = extendOutputKDF(prk, totalNeeded, engine);
 
   // Reserve memory for output buffer
   std::vector<uint8_t> outBuffer;
@@ -120,15 +125,21 @@ static std::vector<uint8_t> puzzleEncryptBufferWithHeader(
   uint64_t nonceCounter = 0;
   size_t remaining = hdr.originalSize;
   //int progressInterval = 1'000'000;
-  static uint16_t reverseMap[256 * 65536];
-  static uint16_t reverseMapOffsets[256];
-  std::bitset<65536> usedIndices;
+  ScatterMatcher matcher(blockSize);
 
   // Preallocate variables outside the loop
   std::vector<uint8_t> chosenNonce(nonceSize);
   std::vector<uint16_t> scatterIndices(blockSize);
-  std::vector<uint8_t> hashOut(hash_size / 8);
-  std::vector<uint8_t> trial;
+  std::vector<uint8_t> trial(subkeySize + nonceSize);
+  TrialOutput output(engine, trial.size(), outputExtension);
+
+  // Parascatter searches many blocks at once; records land at their fixed offsets
+  if (searchModeEnum == 0x05) {
+    outBuffer.resize(headerData.size() + totalBlocks * nonceSize + compressed.size() * sizeof(uint16_t));
+    parascatterBlocks(compressed, blockSize, allSubkeys, subkeySize, nonceSize, engine, seed,
+                      deterministicNonce, outputExtension, verbose, outBuffer.data() + headerData.size());
+    return outBuffer;
+  }
 
   // Precompute initial offsets
   size_t blockOffset = 0;  // Cumulative offset for `compressed` data
@@ -147,199 +158,156 @@ static std::vector<uint8_t> puzzleEncryptBufferWithHeader(
     const uint8_t* blockSubkey = &allSubkeys[subkeyOffset];
     subkeyOffset += subkeySize; // Increment offset by subkeySize
 
-    if (searchModeEnum == 0x05) {
-      auto result = parallelParascatter(
-        blockIndex, thisBlockSize, block, std::vector<uint8_t>(blockSubkey, blockSubkey + subkeySize),
-        nonceSize, hash_size, seed, algot, deterministicNonce, outputExtension, totalBlocks,
-        verbose
-      );
-      outBuffer.insert(outBuffer.end(), result.chosenNonce.begin(), result.chosenNonce.end());
-      const uint8_t* si = reinterpret_cast<const uint8_t*>(result.scatterIndices.data());
-      outBuffer.insert(outBuffer.end(), si, si + result.scatterIndices.size() * sizeof(uint16_t));
-    } else {
-      // Other modes
-      bool found = false;
-
-      for (uint64_t tries = 0; !found; ++tries) {
-        // Generate nonce
-        if (deterministicNonce) {
-          for (size_t i = 0; i < nonceSize; ++i) {
-            chosenNonce[i] = static_cast<uint8_t>((nonceCounter >> (i * 8)) & 0xFF);
-          }
-          ++nonceCounter;
-        } else {
-          rng.as<uint8_t>(nonceSize).swap(chosenNonce);
-          //rng.fill(chosenNonce.data(), nonceSize);
-        }
+    // Serial modes
+    bool found = false;
+    const PrefixHasher subkeyPrefix(engine, blockSubkey, subkeySize, nonceSize, seed);
+    const size_t outputLen = output.size();
 
-        // Build trial buffer
-        trial.assign(blockSubkey, blockSubkey + subkeySize);
-        trial.insert(trial.end(), chosenNonce.begin(), chosenNonce.end());
+    if (searchModeEnum >= 0x02) {
+      matcher.setBlock(block.data(), thisBlockSize);
+    }
 
-        // Hash trial
-        invokeHash<bswap>(algot, seed, trial, hashOut, hash_size);
-        std::vector<uint8_t> finalHashOut = hashOut;
-        if (outputExtension > 0) {
-          std::vector<uint8_t> extendedOutput = extendOutputKDF(trial, outputExtension, algot, hash_size);
-          finalHashOut.insert(finalHashOut.end(), extendedOutput.begin(), extendedOutput.end());
+    for (uint64_t tries = 0; !found; ++tries) {
+      // Generate nonce
+      if (deterministicNonce) {
+        for (size_t i = 0; i < nonceSize; ++i) {
+          chosenNonce[i] = static_cast<uint8_t>((nonceCounter >> (i * 8)) & 0xFF);
         }
+        ++nonceCounter;
+      } else {
+        rng.as<uint8_t>(nonceSize).swap(chosenNonce);
+        //rng.fill(chosenNonce.data(), nonceSize);
+      }
 
-        // Check the search mode
-        if (searchModeEnum == 0x00) { // prefix
-          if (finalHashOut.size() >= thisBlockSize &&
-              std::equal(block.begin(), block.end(), finalHashOut.begin())) {
+      // Build trial buffer
+      std::copy(blockSubkey, blockSubkey + subkeySize, trial.begin());
+      std::copy(chosenNonce.begin(), chosenNonce.end(), trial.begin() + subkeySize);
+
+      // Hash trial (subkey absorbed once above); the extension is produced as it is read
+      output.begin(trial.data());
+      subkeyPrefix(chosenNonce.data(), output.data());
+      const uint8_t* finalHashOut = output.data();
+
+      // Check the search mode
+      if (searchModeEnum == 0x00) { // prefix
+        if (outputLen >= thisBlockSize) {
+          // Compare a counter block at a time, stopping at the first mismatch
+          bool match = true;
+          for (size_t pos = 0; match && pos < thisBlockSize; ) {
+            const size_t upTo = std::min(thisBlockSize, output.reach(pos + 1));
+            match = std::equal(block.begin() + pos, block.begin() + upTo, finalHashOut + pos);
+            pos = upTo;
+          }
+          if (match) {
             scatterIndices.assign(thisBlockSize, 0);
             found = true;
           }
-        } else if (searchModeEnum == 0x01) { // sequence
-          for (size_t i = 0; i <= finalHashOut.size() - thisBlockSize; i++) {
-            if (std::equal(block.begin(), block.end(), finalHashOut.begin() + i)) {
-              uint16_t startIdx = static_cast<uint16_t>(i);
-              scatterIndices.assign(thisBlockSize, startIdx);
-              found = true;
-              break;
-            }
-          }
-        } else if (searchModeEnum == 0x02) { // series
-          bool allFound = true;
-          usedIndices.reset();
-          auto it = finalHashOut.begin();
-
-          for (size_t byteIdx = 0; byteIdx < thisBlockSize; byteIdx++) {
-              while (it != finalHashOut.end()) {
-                  it = std::find(it, finalHashOut.end(), block[byteIdx]);
-                  if (it != finalHashOut.end()) {
-                      uint16_t idx = static_cast<uint16_t>(std::distance(finalHashOut.begin(), it));
-                      if (!usedIndices.test(idx)) {
-                          scatterIndices[byteIdx] = idx;
-                          usedIndices.set(idx);
-                          break;
-                      }
-                      ++it;
-                  }
-                  else {
-                      allFound = false;
-                      break;
-                  }
-              }
-              if (it == finalHashOut.end()) {
-                  allFound = false;
-                  break;
-              }
-          }
-
-          if (allFound) {
-              found = true;
-              if (verbose) {
-                  std::cout << "Series Indices: ";
-                  for (auto idx : scatterIndices) {
-                      std::cout << static_cast<uint16_t>(idx) << " ";
-                  }
-                  std::cout << std::endl;
-              }
+        }
+      } else if (searchModeEnum == 0x01) { // sequence
+        // The first start index wins, so stop extending once a window matches
+        for (size_t i = 0; i + thisBlockSize <= outputLen; i++) {
+          output.reach(i + thisBlockSize);
+          if (std::equal(block.begin(), block.end(), finalHashOut + i)) {
+            uint16_t startIdx = static_cast<uint16_t>(i);
+            scatterIndices.assign(thisBlockSize, startIdx);
+            found = true;
+            break;
           }
-        } else if (searchModeEnum == 0x03) { // scatter
-          bool allFound = true;
-          usedIndices.reset();
-
-          for (size_t byteIdx = 0; byteIdx < thisBlockSize; byteIdx++) {
-            auto it = finalHashOut.begin();
-            while (it != finalHashOut.end()) {
-              it = std::find(it, finalHashOut.end(), block[byteIdx]);
-              if (it != finalHashOut.end()) {
-                uint16_t idx = static_cast<uint16_t>(std::distance(finalHashOut.begin(), it));
-                if (!usedIndices.test(idx)) {
-                  scatterIndices[byteIdx] = idx;
-                  usedIndices.set(idx);
-                  break;
+        }
+      } else if (searchModeEnum == 0x02) { // series
+        if (matcher.matchSeries(output, scatterIndices.data())) {
+            found = true;
+            if (verbose) {
+                std::cout << "Series Indices: ";
+                for (auto idx : scatterIndices) {
+                    std::cout << static_cast<uint16_t>(idx) << " ";
                 }
-                ++it;
-              } else {
-                allFound = false;
-                break;
-              }
-            }
-            if (it == finalHashOut.end()) {
-                allFound = false;
-                break;
+                std::cout << std::endl;
             }
-          }
-          if (allFound) {
-            found = true;
-          }
-        } else if (searchModeEnum == 0x04) { // mapscatter
-          // Reset offsets
-          std::fill(std::begin(reverseMapOffsets), std::end(reverseMapOffsets), 0);
-
-          // Fill the map with all positions of each byte in finalHashOut
-          for (uint16_t i = 0; i < finalHashOut.size(); i++) {
-              uint8_t b = finalHashOut[i];
-              reverseMap[b * 65536 + reverseMapOffsets[b]] = i;
-              reverseMapOffsets[b]++;
-          }
-
-          bool allFound = true;
-          for (size_t byteIdx = 0; byteIdx < thisBlockSize; ++byteIdx) {
-              uint8_t targetByte = block[byteIdx];
-              if (reverseMapOffsets[targetByte] == 0) {
-                  allFound = false;
-                  break;
-              }
-              reverseMapOffsets[targetByte]--;
-              scatterIndices[byteIdx] =
-                  reverseMap[targetByte * 65536 + reverseMapOffsets[targetByte]];
-          }
-
-          if (allFound) {
-              found = true;
-              if (verbose) {
-                  std::cout << "Scatter Indices: ";
-                  for (auto idx : scatterIndices) {
-                      std::cout << static_cast<uint16_t>(idx) << " ";
-                  }
-                  std::cout << std::endl;
-              }
-          }
         }
-        if (tries % 100000 == 0 && verbose) {
-          std::cerr << "\r[Enc] Block " << (blockIndex + 1) << "/" << totalBlocks
-                    << ", " << tries << " tries..." << std::flush;
+      } else if (searchModeEnum == 0x03) { // scatter
+        if (matcher.matchForward(output, scatterIndices.data())) {
+          found = true;
         }
-      }
-      if (found) {
-        outBuffer.insert(outBuffer.end(), chosenNonce.begin(), chosenNonce.end());
-        // Write indices
-        if (searchModeEnum == 0x02 || searchModeEnum == 0x03 ||
-            searchModeEnum == 0x04) {
-          const uint8_t* si = reinterpret_cast<const uint8_t*>(scatterIndices.data());
-          outBuffer.insert(outBuffer.end(), si, si + scatterIndices.size() * sizeof(uint16_t));
-        } else if (searchModeEnum == 0x00 || searchModeEnum == 0x01) {
-          uint16_t startIdx = scatterIndices[0];
-          const uint8_t* idxPtr = reinterpret_cast<const uint8_t*>(&startIdx);
-          outBuffer.insert(outBuffer.end(), idxPtr, idxPtr + sizeof(startIdx));
+      } else if (searchModeEnum == 0x04) { // mapscatter
+        // Indices come from the end of the output, so the whole extension is needed
+        output.reach(outputLen);
+
+        if (matcher.matchBackward(finalHashOut, outputLen, scatterIndices.data())) {
+            found = true;
+            if (verbose) {
+                std::cout << "Scatter Indices: ";
+                for (auto idx : scatterIndices) {
+                    std::cout << static_cast<uint16_t>(idx) << " ";
+                }
+                std::cout << std::endl;
+            }
         }
       }
+      if (tries % 100000 == 0 && verbose) {
+        std::cerr << "\r[Enc] Block " << (blockIndex + 1) << "/" << totalBlocks
+                  << ", " << tries << " tries..." << std::flush;
+      }
+    }
+    if (found) {
+      outBuffer.insert(outBuffer.end(), chosenNonce.begin(), chosenNonce.end());
+      // Write indices
+      if (searchModeEnum == 0x02 || searchModeEnum == 0x03 ||
+          searchModeEnum == 0x04) {
+        const uint8_t* si = reinterpret_cast<const uint8_t*>(scatterIndices.data());
+        outBuffer.insert(outBuffer.end(), si, si + scatterIndices.size() * sizeof(uint16_t));
+      } else if (searchModeEnum == 0x00 || searchModeEnum == 0x01) {
+        uint16_t startIdx = scatterIndices[0];
+        const uint8_t* idxPtr = reinterpret_cast<const uint8_t*>(&startIdx);
+        outBuffer.insert(outBuffer.end(), idxPtr, idxPtr + sizeof(startIdx));
+      }
     }
   }
 
   return outBuffer;
 }
 
+// Vector form, used by the wasm exports
+[[maybe_unused]] static std::vector<uint8_t> puzzleEncryptBufferWithHeader(
+  const std::vector<uint8_t> &plainData,
+  std::vector<uint8_t> key,
+  HashAlgorithm algot,
+  uint32_t hash_size,
+  uint64_t seed,
+  const std::vector<uint8_t> &salt,
+  uint16_t blockSize,
+  uint16_t nonceSize,
+  const std::string &searchMode,
+  bool verbose,
+  bool deterministicNonce,
+  uint16_t outputExtension
+) {
+  return puzzleEncryptBufferWithHeader(plainData.data(), plainData.size(), key, algot, hash_size, seed,
+                                       salt, blockSize, nonceSize, searchMode, verbose,
+                                       deterministicNonce, outputExtension);
+}
+
+/**
+ * Decrypt a block-enc buffer. Every block record (nonce, then one start index or
+ * blockSize scatter indices) has a fixed size, so record i sits at a position known
+ * from the header: the records are parsed in place and blocks are decrypted in parallel,
+ * each thread reusing one trial / hash-output buffer and writing its block straight into
+ * the preallocated plaintext.
+ */
 static std::vector<uint8_t> puzzleDecryptBufferWithHeader(
-  const std::vector<uint8_t> &cipherText,
+  const uint8_t *cipherText,
+  size_t cipherSize,
   std::vector<uint8_t> key
 ) {
-  // Parse the FileHeader from the front of cipherData
-  // Then reconstruct the plaintext.
-
-  if (cipherText.size() < sizeof(PackedHeader)) {
+  if (cipherSize < sizeof(PackedHeader)) {
     throw std::runtime_error("Cipher data too small to contain valid header.");
   }
 
-  std::istringstream inStream(std::string(cipherText.begin(), cipherText.end()), std::ios::binary);
-
-  // Read the header
+  // Read the header straight out of the caller's buffer
+  MappedStreamBuf inBuf(cipherText, cipherSize);
+  std::istream inStream(&inBuf);
   FileHeader hdr = readFileHeader(inStream);
+  const size_t headerLen = static_cast<size_t>(inStream.tellg());
 
   if (hdr.magic != MagicNumber) {
     throw std::runtime_error("Invalid magic number.");
@@ -347,6 +315,12 @@ static std::vector<uint8_t> puzzleDecryptBufferWithHeader(
   if (hdr.cipherMode != 0x11) {
     throw std::runtime_error("Not block cipher mode (expected 0x11).");
   }
+  if (hdr.searchModeEnum > 0x05) {
+    throw std::runtime_error("Invalid searchModeEnum in decryption.");
+  }
+  if (hdr.blockSize == 0) {
+    throw std::runtime_error("Invalid block size in header.");
+  }
 
   // Determine HashAlgorithm
   HashAlgorithm algot = HashAlgorithm::Unknown;
@@ -357,6 +331,22 @@ static std::vector<uint8_t> puzzleDecryptBufferWithHeader(
   } else {
     throw std::runtime_error("Unsupported hash algorithm: " + hdr.hashName);
   }
+  const HashEngine engine = HashEngine::resolve<bswap>(algot, hdr.hashSizeBits);
+
+  // Record layout
+  const bool scatterMode = hdr.searchModeEnum >= 0x02;
+  const size_t blockSize = hdr.blockSize;
+  const size_t nonceSize = hdr.nonceSize;
+  const size_t recordSize = nonceSize + (scatterMode ? blockSize : 1) * sizeof(uint16_t);
+  const size_t totalBlocks = (hdr.originalSize + blockSize - 1) / blockSize;
+  if (totalBlocks > 0) {
+    const size_t lastBlockSize = hdr.originalSize - (totalBlocks - 1) * blockSize;
+    const size_t lastRecord = nonceSize + (scatterMode ? lastBlockSize : 1) * sizeof(uint16_t);
+    if ((totalBlocks - 1) > (cipherSize - headerLen) / recordSize ||
+        headerLen + (totalBlocks - 1) * recordSize + lastRecord > cipherSize) {
+      throw std::runtime_error("Cipher data ended before the last block record.");
+    }
+  }
 
   // Derive PRK
   std::vector<uint8_t> ikm(key.begin(), key.end());
@@ -364,112 +354,137 @@ static std::vector<uint8_t> puzzleDecryptBufferWithHeader(
   for (size_t i = 0; i < 8; ++i) {
     seed_vec[i] = static_cast<uint8_t>((hdr.iv >> (i * 8)) & 0xFF);
   }
-  std::vector<uint8_t> prk = derivePRK(seed_vec, hdr.salt, ikm, algot, hdr.hashSizeBits);
+  std::vector<uint8_t> prk = derivePRK(seed_vec, hdr.salt, ikm, engine);
 
   // Extend into subkeys
-  size_t totalBlocks = (hdr.originalSize + hdr.blockSize - 1) / hdr.blockSize;
-  size_t subkeySize = hdr.hashSizeBits / 8;
-  size_t totalNeeded = totalBlocks * subkeySize;
-  std::vector<uint8_t> allSubkeys = extendOutputKDF(prk, totalNeeded, algot, hdr.hashSizeBits);
+  const size_t subkeySize = hdr.hashSizeBits / 8;
+  std::vector<uint8_t> allSubkeys = extendOutputKDF(prk, totalBlocks * subkeySize, engine);
 
   // Reconstruct plaintext
-  std::vector<uint8_t> plaintextAccumulated;
-  plaintextAccumulated.reserve(hdr.originalSize);
-
-  for (size_t blockIndex = 0; blockIndex < totalBlocks; blockIndex++) {
-    size_t thisBlockSize = std::min<size_t>(hdr.blockSize, hdr.originalSize - plaintextAccumulated.size());
-
-    // Read storedNonce directly from inStream
-    std::vector<uint8_t> storedNonce(hdr.nonceSize);
-    inStream.read(reinterpret_cast<char*>(storedNonce.data()), hdr.nonceSize);
-    if (inStream.gcount() != hdr.nonceSize) {
-      throw std::runtime_error("Cipher data ended while reading nonce.");
-    }
-
-    // Read scatterIndices or startIndex
-    std::vector<uint16_t> scatterIndices;
-    uint16_t startIndex = 0;
-    if (hdr.searchModeEnum == 0x02 || hdr.searchModeEnum == 0x03 ||
-        hdr.searchModeEnum == 0x04 || hdr.searchModeEnum == 0x05) {
-      uint32_t scatterDataSize = thisBlockSize * sizeof(uint16_t);
-      scatterIndices.resize(thisBlockSize);
-      inStream.read(reinterpret_cast<char*>(scatterIndices.data()), scatterDataSize);
-      if (inStream.gcount() != scatterDataSize) {
-        throw std::runtime_error("Cipher data ended while reading scatter indices.");
+  std::vector<uint8_t> plaintextAccumulated(hdr.originalSize);
+  const size_t trialLen = subkeySize + nonceSize;
+  const size_t hashOutLen = engine.size() + hdr.outputExtension;
+  std::atomic<bool> failed(false);
+  std::string failure;
+  std::atomic<size_t> blocksDone(0);
+
+  #pragma omp parallel
+  {
+    // trial || KDF info: the trial is hashed alone, and the whole is the extension's prefix
+    std::vector<uint8_t> trial(trialLen + KDF_INFO_STRING.size());
+    std::copy(KDF_INFO_STRING.begin(), KDF_INFO_STRING.end(), trial.begin() + trialLen);
+    std::vector<uint8_t> finalHashOut(hashOutLen);
+    std::vector<uint16_t> indices(scatterMode ? blockSize : 1);
+    // Extension counter blocks this record reads, stamped with blockIndex + 1 so the
+    // marks never need clearing
+    std::vector<size_t> extensionStamp((hdr.outputExtension + engine.size() - 1) / engine.size(), 0);
+    std::vector<size_t> extensionNeeded;
+    extensionNeeded.reserve(extensionStamp.size());
+
+    #pragma omp for schedule(dynamic, 16)
+    for (size_t blockIndex = 0; blockIndex < totalBlocks; blockIndex++) {
+      if (failed.load(std::memory_order_relaxed)) continue;
+      const size_t thisBlockSize = std::min<size_t>(blockSize, hdr.originalSize - blockIndex * blockSize);
+      const uint8_t *record = cipherText + headerLen + blockIndex * recordSize;
+
+      // Stored nonce and scatterIndices or startIndex, in place
+      std::memcpy(indices.data(), record + nonceSize, (scatterMode ? thisBlockSize : 1) * sizeof(uint16_t));
+
+      // Check the stored positions and note which extension counter blocks they fall in;
+      // only those are computed, not the whole extension
+      const char *error = nullptr;
+      size_t readFrom = 0, readTo = 0; // Contiguous read: prefix and sequence
+      const size_t stamp = blockIndex + 1;
+      extensionNeeded.clear();
+      auto need = [&](size_t pos) {
+        if (pos < engine.size()) return;
+        const size_t n = (pos - engine.size()) / engine.size();
+        if (extensionStamp[n] != stamp) {
+          extensionStamp[n] = stamp;
+          extensionNeeded.push_back(n);
+        }
+      };
+      if (hdr.searchModeEnum == 0x00) { // prefix
+        if (hashOutLen < thisBlockSize) {
+          error = "Hash output smaller than block size in prefix mode.";
+        }
+        readTo = thisBlockSize;
+      } else if (hdr.searchModeEnum == 0x01) { // sequence
+        if (indices[0] + thisBlockSize > hashOutLen) {
+          error = "Start index out of bounds in sequence mode.";
+        }
+        readFrom = indices[0];
+        readTo = indices[0] + thisBlockSize;
+      } else {
+        for (size_t j = 0; j < thisBlockSize; j++) {
+          if (indices[j] >= hashOutLen) {
+            error = "Scatter index out of range in finalHashOut.";
+            break;
+          }
+          need(indices[j]);
+        }
       }
-    } else {
-      // prefix or sequence
-      inStream.read(reinterpret_cast<char*>(&startIndex), sizeof(startIndex));
-      if (inStream.gcount() != sizeof(startIndex)) {
-        throw std::runtime_error("Cipher data ended while reading start index.");
+      if (!error && readTo > readFrom) {
+        for (size_t pos = std::max(readFrom, engine.size()); pos < readTo; pos += engine.size()) {
+          need(pos);
+        }
+        need(readTo - 1);
       }
-    }
-
-    // Subkey
-    size_t subkeyOffset = blockIndex * subkeySize;
-    if (subkeyOffset + subkeySize > allSubkeys.size()) {
-      throw std::runtime_error("Subkey index out of range in decryption.");
-    }
-    std::vector<uint8_t> blockSubkey(
-      allSubkeys.begin() + subkeyOffset,
-      allSubkeys.begin() + subkeyOffset + subkeySize
-    );
-
-    // Recompute hash
-    std::vector<uint8_t> trial(blockSubkey);
-    trial.insert(trial.end(), storedNonce.begin(), storedNonce.end());
-
-    std::vector<uint8_t> hashOut(hdr.hashSizeBits / 8);
-    invokeHash<bswap>(algot, hdr.iv, trial, hashOut, hdr.hashSizeBits);
-
-    std::vector<uint8_t> finalHashOut = hashOut;
-    if (hdr.outputExtension > 0) {
-      std::vector<uint8_t> extended = extendOutputKDF(trial, hdr.outputExtension, algot, hdr.hashSizeBits);
-      finalHashOut.insert(finalHashOut.end(), extended.begin(), extended.end());
-    }
-
-    // Reconstruct block
-    std::vector<uint8_t> block;
-    block.reserve(thisBlockSize);
 
-    if (hdr.searchModeEnum == 0x00) { // prefix
-      if (finalHashOut.size() < thisBlockSize) {
-        throw std::runtime_error("Hash output smaller than block size in prefix mode.");
+      // Recompute hash of subkey || nonce, then the needed part of its extension
+      if (!error) {
+        std::memcpy(trial.data(), allSubkeys.data() + blockIndex * subkeySize, subkeySize);
+        std::memcpy(trial.data() + subkeySize, record, nonceSize);
+        engine(trial.data(), trialLen, hdr.iv, finalHashOut.data());
+        if (!extensionNeeded.empty()) {
+          const PrefixHasher extensionPrefix(engine, trial.data(), trial.size(), 8, 0);
+          for (size_t n : extensionNeeded) {
+            const size_t offset = n * engine.size();
+            kdfBlocks(extensionPrefix, engine, n, finalHashOut.data() + engine.size() + offset,
+                      std::min<size_t>(engine.size(), hdr.outputExtension - offset), KDF_ITERATIONS, false);
+          }
+        }
       }
-      block.assign(finalHashOut.begin(), finalHashOut.begin() + thisBlockSize);
-    } else if (hdr.searchModeEnum == 0x01) { // sequence
-      if (startIndex + thisBlockSize > finalHashOut.size()) {
-        throw std::runtime_error("Start index out of bounds in sequence mode.");
+
+      // Reconstruct block
+      uint8_t *block = plaintextAccumulated.data() + blockIndex * blockSize;
+      if (!error) {
+        if (scatterMode) {
+          for (size_t j = 0; j < thisBlockSize; j++) {
+            block[j] = finalHashOut[indices[j]];
+          }
+        } else {
+          std::memcpy(block, finalHashOut.data() + readFrom, thisBlockSize);
+        }
       }
-      block.assign(finalHashOut.begin() + startIndex,
-                   finalHashOut.begin() + startIndex + thisBlockSize);
-    } else if (hdr.searchModeEnum == 0x02 || hdr.searchModeEnum == 0x03 ||
-               hdr.searchModeEnum == 0x04 || hdr.searchModeEnum == 0x05) {
-      for (size_t j = 0; j < thisBlockSize; j++) {
-        uint16_t idx = scatterIndices[j];
-        if (idx >= finalHashOut.size()) {
-          throw std::runtime_error("Scatter index out of range in finalHashOut.");
+      if (error) {
+        #pragma omp critical
+        if (!failed.exchange(true)) {
+          failure = error;
         }
-        block.push_back(finalHashOut[idx]);
+        continue;
       }
-    } else {
-      throw std::runtime_error("Invalid searchModeEnum in decryption.");
-    }
-
-    plaintextAccumulated.insert(plaintextAccumulated.end(), block.begin(), block.end());
 
-    if (blockIndex % 100 == 0) {
-      fprintf(stderr, "\r[Dec] Processing block %zu/%zu...", (blockIndex + 1), totalBlocks);
+      const size_t done = blocksDone.fetch_add(1, std::memory_order_relaxed);
+      if (done % 100 == 0) {
+        fprintf(stderr, "\r[Dec] Processing block %zu/%zu...", (done + 1), totalBlocks);
+      }
     }
   }
+  if (failed) {
+    throw std::runtime_error(failure);
+  }
 
   // Done reading, now decompress
-  std::vector<uint8_t> decompressedData = decompressData(plaintextAccumulated);
-  if (plaintextAccumulated.size() != hdr.originalSize) {
-    throw std::runtime_error("Compressed data size mismatch vs. original size header.");
-  }
+  return decompressData(plaintextAccumulated);
+}
 
-  return decompressedData;
+// Vector form, used by the wasm exports
+[[maybe_unused]] static std::vector<uint8_t> puzzleDecryptBufferWithHeader(
+  const std::vector<uint8_t> &cipherText,
+  std::vector<uint8_t> key
+) {
+  return puzzleDecryptBufferWithHeader(cipherText.data(), cipherText.size(), key);
 }
 
 static void puzzleEncryptFileWithHeader(
@@ -487,20 +502,13 @@ static void puzzleEncryptFileWithHeader(
   bool deterministicNonce,
   uint32_t outputExtension
 ) {
-  // 1) Read & compress plaintext from file
-  std::ifstream fin(inFilename, std::ios::binary);
-  if (!fin.is_open()) {
-    throw std::runtime_error("Cannot open input file: " + inFilename);
-  }
-  std::vector<uint8_t> plainData(
-    (std::istreambuf_iterator<char>(fin)),
-    (std::istreambuf_iterator<char>())
-  );
-  fin.close();
+  // 1) Map the plaintext; it is compressed straight out of the mapping
+  const MappedFile plainData(inFilename);
 
   // 2) Call the new buffer-based API
   std::vector<uint8_t> encrypted = puzzleEncryptBufferWithHeader(
-    plainData,
+    plainData.data(),
+    plainData.size(),
     key,
     algot,
     hash_size,
@@ -514,46 +522,50 @@ static void puzzleEncryptFileWithHeader(
     outputExtension
   );
 
-  // 3) Write the resulting ciphertext to file
-  std::ofstream fout(outFilename, std::ios::binary);
-  if (!fout.is_open()) {
-    throw std::runtime_error("Cannot open output file: " + outFilename);
-  }
-  fout.write(reinterpret_cast<const char*>(encrypted.data()), encrypted.size());
-  fout.close();
+  // 3) Tag header || ciphertext in place (the header's HMAC field is still zero), so the
+  //    file is written once and never reopened to patch the HMAC in
+  HmacContext mac(key, encrypted.size());
+  mac.update(encrypted);
+  std::vector<uint8_t> hmac = mac.final();
+  std::copy(hmac.begin(), hmac.end(), encrypted.begin() + FILE_HEADER_HMAC_OFFSET);
+
+  // 4) Write the resulting ciphertext to file
+  writeFileBytes(outFilename, encrypted);
 
   std::cout << "\n[Enc] Block-based puzzle encryption with subkeys complete: " << outFilename << "\n";
 }
 
+// Verifies the file HMAC, then decrypts; the mapped file is the only read of the ciphertext
 static void puzzleDecryptFileWithHeader(
   const std::string &inFilename,
   const std::string &outFilename,
   std::vector<uint8_t> key
 ) {
-  // 1) Read the ciphertext file
-  std::ifstream fin(inFilename, std::ios::binary);
-  if (!fin.is_open()) {
-    throw std::runtime_error("Cannot open ciphertext file: " + inFilename);
+  // 1) Map the ciphertext file and check its tag before any puzzle work
+  const MappedFile input(inFilename);
+  MappedStreamBuf inBuf(input.data(), input.size());
+  std::istream fin(&inBuf);
+  FileHeader hdr = readFileHeader(fin);
+  const size_t headerLen = static_cast<size_t>(fin.tellg());
+  const std::vector<uint8_t> headerData = serializeFileHeaderForHMAC(hdr);
+  HmacContext mac(key, headerData.size() + (input.size() - headerLen));
+  mac.update(headerData);
+  mac.update(input.data() + headerLen, input.size() - headerLen);
+  if (!hmacEqual(mac.final(), std::vector<uint8_t>(hdr.hmac.begin(), hdr.hmac.end()))) {
+    throw std::runtime_error("[Dec] HMAC verification failed! File may be corrupted or tampered with.");
   }
-  std::vector<uint8_t> cipherData(
-    (std::istreambuf_iterator<char>(fin)),
-    (std::istreambuf_iterator<char>())
-  );
-  fin.close();
 
   // 2) Call the new buffer-based API
   std::vector<uint8_t> decompressedData = puzzleDecryptBufferWithHeader(
-    cipherData,
+    input.data(),
+    input.size(),
     key
   );
 
   // 3) Write the decompressed plaintext to file
-  std::ofstream fout(outFilename, std::ios::binary);
-  if (!fout.is_open()) {
-    throw std::runtime_error("Cannot open output file for plaintext: " + outFilename);
-  }
-  fout.write(reinterpret_cast<const char*>(decompressedData.data()), decompressedData.size());
-  fout.close();
+  StagedOutput staged(outFilename);
+  writeFileBytes(staged.partPath(), decompressedData);
+  staged.commit();
 
   std::cout << "[Dec] Decompressed plaintext written to: " << outFilename << "\n";
 }
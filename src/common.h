@@ -15,11 +15,191 @@ constexpr size_t CHUNK_SIZE = 16384;
 
 typedef uint64_t seed_t;
 
+// SIMD kernel selection. The vector kernels are compiled once per ISA with function-level
+// target attributes, so a build without -march flags still carries all of them. The widest
+// one this CPU supports is chosen on first use; rainsum --kernel can force a narrower one.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__EMSCRIPTEN__)
+#define RAIN_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+enum class SimdKernel : uint8_t {
+  Scalar = 0,
+  AVX2 = 1,
+  AVX512 = 2
+};
+
+static inline bool simdKernelSupported(SimdKernel kernel) {
+  switch (kernel) {
+    case SimdKernel::Scalar:
+      return true;
+#if defined(RAIN_X86_KERNELS)
+    case SimdKernel::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+    case SimdKernel::AVX512:
+      // DQ/BW/VL for rainbow's 64-bit lane multiplies and masked byte loads; every AVX-512
+      // CPU since Skylake-SP has them (only Xeon Phi does not)
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+             __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+#endif
+    default:
+      return false;
+  }
+}
+
+static inline SimdKernel detectSimdKernel() {
+  if (simdKernelSupported(SimdKernel::AVX512)) return SimdKernel::AVX512;
+  if (simdKernelSupported(SimdKernel::AVX2)) return SimdKernel::AVX2;
+  return SimdKernel::Scalar;
+}
+
+// One process-wide selection shared by every translation unit
+inline SimdKernel& activeSimdKernel() {
+  static SimdKernel kernel = detectSimdKernel();
+  return kernel;
+}
+
+static inline const char* simdKernelName(SimdKernel kernel) {
+  switch (kernel) {
+    case SimdKernel::AVX2:
+      return "avx2";
+    case SimdKernel::AVX512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
+
+// dst[i] ^= src[i] for n bytes, on the active kernel's widest registers. Used to apply a
+// keystream block straight from a stack buffer to the data.
+#if defined(RAIN_X86_KERNELS)
+__attribute__((target("avx512f,avx512bw")))
+static inline void xorBytesAVX512(uint8_t* dst, const uint8_t* src, size_t n) {
+  for (; n >= 64; n -= 64, dst += 64, src += 64) {
+    _mm512_storeu_si512(dst, _mm512_xor_si512(_mm512_loadu_si512(dst), _mm512_loadu_si512(src)));
+  }
+  if (n) {
+    const __mmask64 m = ~UINT64_C(0) >> (64 - n);
+    _mm512_mask_storeu_epi8(dst, m, _mm512_xor_si512(_mm512_maskz_loadu_epi8(m, dst),
+                                                     _mm512_maskz_loadu_epi8(m, src)));
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void xorBytesAVX2(uint8_t* dst, const uint8_t* src, size_t n) {
+  for (; n >= 32; n -= 32, dst += 32, src += 32) {
+    const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst));
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_xor_si256(d, s));
+  }
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] ^= src[i];
+  }
+}
+#endif
+
+static inline void xorBytesScalar(uint8_t* dst, const uint8_t* src, size_t n) {
+  for (; n >= 8; n -= 8, dst += 8, src += 8) {
+    uint64_t d, s;
+    std::memcpy(&d, dst, 8);
+    std::memcpy(&s, src, 8);
+    d ^= s;
+    std::memcpy(dst, &d, 8);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] ^= src[i];
+  }
+}
+
+static inline void xorBytes(uint8_t* dst, const uint8_t* src, size_t n) {
+  switch (activeSimdKernel()) {
+#if defined(RAIN_X86_KERNELS)
+    case SimdKernel::AVX512:
+      xorBytesAVX512(dst, src, n);
+      return;
+    case SimdKernel::AVX2:
+      xorBytesAVX2(dst, src, n);
+      return;
+#endif
+    default:
+      xorBytesScalar(dst, src, n);
+  }
+}
+
+// CRTP base for the incremental hashers. It buffers partial blocks so a state can be fed
+// in any chunking; Derived supplies absorb(block) for every full block and
+// finish(tail, tailLen, out) for the padded final block. Calls resolve at compile time.
+template <typename Derived, size_t BlockSize>
 struct IHashState {
-    virtual void update(const uint8_t* chunk, size_t chunk_len) = 0;
-    virtual void finalize(void* out) = 0;
-    virtual ~IHashState() = default;
-    size_t len;
+    uint8_t buf[BlockSize];
+    size_t  buflen = 0;
+    size_t  len = 0;
+    bool    finalized = false;
+
+    void update(const uint8_t* chunk, size_t chunk_len) {
+      if (finalized) {
+        // can't update after finalize
+        return;
+      }
+      Derived& self = static_cast<Derived&>(*this);
+      len += chunk_len;
+
+      // Top up a partial block left over from the previous call
+      if (buflen > 0) {
+        size_t take = BlockSize - buflen < chunk_len ? BlockSize - buflen : chunk_len;
+        std::memcpy(buf + buflen, chunk, take);
+        buflen += take;
+        chunk += take;
+        chunk_len -= take;
+        if (buflen < BlockSize) {
+          return;
+        }
+        self.absorb(buf);
+        buflen = 0;
+      }
+
+      while (chunk_len >= BlockSize) {
+        self.absorb(chunk);
+        chunk += BlockSize;
+        chunk_len -= BlockSize;
+      }
+
+      std::memcpy(buf, chunk, chunk_len);
+      buflen = chunk_len;
+    }
+
+    void finalize(void* out) {
+      if (finalized) {
+        return;
+      }
+      static_cast<Derived&>(*this).finish(buf, buflen, (uint8_t *)out);
+      finalized = true;
+    }
+};
+
+// Snapshot of a hash state after a fixed prefix of a message whose total length is known up
+// front (both hashes mix the length into their initial state). Messages that share the
+// prefix resume from a copy of the snapshot, so the prefix blocks are absorbed only once.
+template <typename State>
+struct HashMidstate {
+    State state;
+
+    static HashMidstate capture(const void* prefix, size_t prefixLen, size_t totalLen,
+                                const seed_t seed, uint32_t hashsize) {
+      HashMidstate mid;
+      mid.state = State::initialize(seed, totalLen, hashsize);
+      mid.state.update((const uint8_t*)prefix, prefixLen);
+      return mid;
+    }
+
+    // Hash prefix || suffix; suffixLen must make up the totalLen given to capture()
+    void resume(const void* suffix, size_t suffixLen, void* out) const {
+      State s = state;
+      s.update((const uint8_t*)suffix, suffixLen);
+      s.finalize(out);
+    }
 };
 
 template <bool bswap>
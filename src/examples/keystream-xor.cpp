@@ -0,0 +1,91 @@
+// Benchmark: fused keystream generate-and-XOR (Keystream::xorInto) against the old stream
+// cipher path, which built the whole keystream with extendOutputKDF and XORed it a byte at
+// a time. Also times the XOR kernels alone on keystream-block-sized pieces.
+// Build: g++ -std=c++20 -O3 -fopenmp -DUSE_FILESYSTEM src/examples/keystream-xor.cpp -o keystream-xor -lz
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "../tool.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void compare(const char* label, KeystreamProfile profile, size_t size) {
+  const HashEngine engine = HashEngine::resolve<bswap>(HashAlgorithm::Rainstorm, 512);
+  const std::vector<uint8_t> prk(engine.size(), 0x5A);
+  const size_t extension = 1024;
+  std::vector<uint8_t> data(size), materialized, fused;
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)(i * 131 + (i >> 9));
+  }
+
+  // Old path (Kdf only): whole keystream, then a byte loop
+  double oldTime = 0;
+  if (profile == KeystreamProfile::Kdf) {
+    materialized = data;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> keystream = extendOutputKDF(prk, size + extension, engine);
+    for (size_t i = 0; i < size; ++i) {
+      materialized[i] ^= keystream[i + extension];
+    }
+    oldTime = seconds(start);
+  }
+
+  fused = data;
+  auto start = std::chrono::steady_clock::now();
+  Keystream keystream(prk, engine, profile);
+  keystream.seek(extension);
+  keystream.xorInto(fused.data(), fused.size());
+  double fusedTime = seconds(start);
+
+  std::cout << label << " " << (size >> 20) << " MiB";
+  if (oldTime > 0) {
+    std::cout << "  materialize+byte-xor: " << size / oldTime / 1e6 << " MB/s (+" << (size >> 20)
+              << " MiB keystream)";
+  }
+  std::cout << "  fused: " << size / fusedTime / 1e6 << " MB/s (+64 B)";
+  if (oldTime > 0) {
+    std::cout << "  speedup: " << oldTime / fusedTime << "x" << (materialized == fused ? "" : "  MISMATCH");
+  }
+  std::cout << "\n";
+}
+
+// The XOR step alone: 64-byte keystream blocks from L1 into a 64 MiB buffer
+static void xorKernels() {
+  std::vector<uint8_t> data(64 << 20, 0x33);
+  uint8_t block[64];
+  for (int i = 0; i < 64; i++) block[i] = (uint8_t)(i * 7);
+
+  auto run = [&](const char* name, auto&& fn) {
+    double best = 1e9;
+    for (int r = 0; r < 5; r++) {
+      auto start = std::chrono::steady_clock::now();
+      for (size_t off = 0; off < data.size(); off += 64) {
+        fn(data.data() + off, block, 64);
+      }
+      best = std::min(best, seconds(start));
+    }
+    std::cout << "xor " << name << ": " << data.size() / best / 1e9 << " GB/s\n";
+  };
+  run("byte loop", [](uint8_t* d, const uint8_t* s, size_t n) {
+    for (size_t i = 0; i < n; ++i) d[i] ^= s[i];
+  });
+  run("scalar   ", xorBytesScalar);
+#if defined(RAIN_X86_KERNELS)
+  if (simdKernelSupported(SimdKernel::AVX2)) run("avx2     ", xorBytesAVX2);
+  if (simdKernelSupported(SimdKernel::AVX512)) run("avx512   ", xorBytesAVX512);
+#endif
+}
+
+int main() {
+  std::cout << "kernel: " << simdKernelName(activeSimdKernel()) << "\n";
+  compare("kdf", KeystreamProfile::Kdf, 1 << 20);
+  compare("kdf", KeystreamProfile::Kdf, 64 << 20);
+  compare("xof", KeystreamProfile::Xof, 64 << 20);
+  xorKernels();
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Benchmark: rainbow::hash_many against a loop of single rainbow calls on short keys.
+// Build: clang++ -std=c++20 -O3 src/examples/rainbow-many.cpp -o rainbow-many
+#include "../rainbow.cpp"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+struct KeySet {
+  std::vector<uint8_t> bytes;
+  std::vector<const void*> keys;
+  std::vector<size_t> lens;
+};
+
+// `count` keys of minLen..maxLen bytes packed back to back
+static KeySet makeKeys(size_t count, size_t minLen, size_t maxLen) {
+  KeySet set;
+  uint64_t x = 0x9E3779B97F4A7C15ULL;
+  set.lens.resize(count);
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    set.lens[i] = minLen + x % (maxLen - minLen + 1);
+    total += set.lens[i];
+  }
+  set.bytes.resize(total);
+  for (size_t i = 0; i < total; i++) {
+    set.bytes[i] = (uint8_t)(i * 131 + (i >> 8));
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    set.keys.push_back(set.bytes.data() + offset);
+    offset += set.lens[i];
+  }
+  return set;
+}
+
+template <uint32_t hashsize>
+static void run(const char* label, size_t minLen, size_t maxLen) {
+  constexpr size_t stride = hashsize / 8;
+  const size_t count = 1 << 22;
+  const int reps = 5;
+  KeySet set = makeKeys(count, minLen, maxLen);
+  std::vector<uint8_t> single(count * stride), batched(count * stride);
+
+  double bestSingle = 1e9, bestBatched = 1e9;
+  for (int r = 0; r < reps; r++) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+      rainbow::rainbow<hashsize, bswap>(set.keys[i], set.lens[i], 0, single.data() + i * stride);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    rainbow::hash_many<hashsize, bswap>(set.keys.data(), set.lens.data(), count, 0, batched.data());
+    auto t2 = std::chrono::steady_clock::now();
+    bestSingle = std::min(bestSingle, std::chrono::duration<double>(t1 - t0).count());
+    bestBatched = std::min(bestBatched, std::chrono::duration<double>(t2 - t1).count());
+  }
+
+  std::cout << "rainbow-" << hashsize << "  " << label
+            << "  per-call: " << count / bestSingle / 1e6 << " Mkeys/s"
+            << "  hash_many: " << count / bestBatched / 1e6 << " Mkeys/s"
+            << "  speedup: " << bestSingle / bestBatched << "x"
+            << (single == batched ? "" : "  MISMATCH") << "\n";
+}
+
+int main() {
+  run<64>("8 bytes    ", 8, 8);
+  run<64>("16 bytes   ", 16, 16);
+  run<64>("1-32 bytes ", 1, 32);
+  run<64>("32-64 bytes", 32, 64);
+  run<128>("8 bytes    ", 8, 8);
+  run<128>("1-32 bytes ", 1, 32);
+  return 0;
+}
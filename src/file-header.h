@@ -5,6 +5,7 @@
 #define FILE_HEADER_H
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 #include <string>
@@ -20,7 +21,7 @@
 struct FileHeader {
     uint32_t magic;                  // MagicNumber
     uint8_t version;                 // Version
-    uint8_t cipherMode;              // Mode: 0x10 = Stream, 0x11 = Block
+    uint8_t cipherMode;              // Mode: 0x10 = Stream, 0x11 = Block, 0x12 = Chunked stream
     uint16_t blockSize;              // Block size in bytes (for block cipher)
     uint16_t nonceSize;              // Nonce size in bytes
     uint16_t hashSizeBits;           // Hash size in bits
@@ -35,8 +36,16 @@ struct FileHeader {
     uint8_t searchModeEnum;          // Search mode enum (0x00 - 0x05 for block ciphers, 0xFF for stream)
     uint64_t originalSize;           // Compressed plaintext size
     std::array<uint8_t, 32> hmac;    // HMAC (256-bit)
+
+    // Version 0x03+ only, stored after the salt (older headers read as 0x00)
+    uint8_t keystreamProfile;        // Stream keystream: 0x00 = KDF (8 rounds), 0x01 = XOF (4 rounds)
+    uint8_t streamFlags;             // Chunked stream: bit 0 = segment index after the end frame,
+                                     // bit 1 = tag after every frame (written from a pipe)
 };
 
+// Headers from this version on carry the extension fields after the salt
+static constexpr uint8_t FILE_HEADER_EXT_VERSION = 0x03;
+
 // -------------------------------------------------------------------
 // Internal PackedHeader struct (For Serialization)
 // -------------------------------------------------------------------
@@ -64,6 +73,10 @@ struct PackedHeader {
 };
 #pragma pack(pop)
 
+// Byte offset of the HMAC field in every serialized header
+static constexpr size_t FILE_HEADER_HMAC_OFFSET = offsetof(PackedHeader, hmac);
+static_assert(FILE_HEADER_HMAC_OFFSET == 33, "HMAC offset is part of the file format");
+
 // -------------------------------------------------------------------
 // Function: writeFileHeader
 // Description: Serializes the FileHeader and writes it to an output stream.
@@ -122,6 +135,15 @@ inline void writeFileHeader(std::ostream &out, const FileHeader &hdr) {
             throw std::runtime_error("Failed to write salt data to stream.");
         }
     }
+
+    // 4) Write extension fields
+    if (hdr.version >= FILE_HEADER_EXT_VERSION) {
+        out.put(static_cast<char>(hdr.keystreamProfile));
+        out.put(static_cast<char>(hdr.streamFlags));
+        if (!out.good()) {
+            throw std::runtime_error("Failed to write header extension fields to stream.");
+        }
+    }
 }
 
 // -------------------------------------------------------------------
@@ -176,7 +198,21 @@ inline FileHeader readFileHeader(std::istream &in) {
         hdr.salt.clear();
     }
 
-    // 4) Validate magic number
+    // 4) Read extension fields
+    hdr.keystreamProfile = 0x00;
+    hdr.streamFlags = 0x00;
+    if (hdr.version >= FILE_HEADER_EXT_VERSION) {
+        char profile = 0, flags = 0;
+        in.get(profile);
+        in.get(flags);
+        if (!in.good()) {
+            throw std::runtime_error("Failed to read header extension fields from stream.");
+        }
+        hdr.keystreamProfile = static_cast<uint8_t>(profile);
+        hdr.streamFlags = static_cast<uint8_t>(flags);
+    }
+
+    // 5) Validate magic number
     if (hdr.magic != MagicNumber) {
         throw std::runtime_error("Invalid magic number in file.");
     }
@@ -189,9 +225,7 @@ inline FileHeader readFileHeader(std::istream &in) {
 // Description: Overwrites only the HMAC field in the output stream.
 // -------------------------------------------------------------------
 inline void writeHMACToStream(std::ostream &out, const std::array<uint8_t, 32> &hmac) {
-    size_t hmac_offset = 33; // Based on PackedHeader structure
-
-    out.seekp(hmac_offset, std::ios::beg);
+    out.seekp(FILE_HEADER_HMAC_OFFSET, std::ios::beg);
     if (!out.good()) {
         throw std::runtime_error("Failed to seek to HMAC position in stream.");
     }
@@ -223,6 +257,9 @@ inline void showFileFullInfo(const std::string &inFilename) {
     else if (hdr.cipherMode == 0x11) {
         cipherModeStr = "BlockCipher";
     }
+    else if (hdr.cipherMode == 0x12) {
+        cipherModeStr = "ChunkedStreamCipher";
+    }
     else {
         cipherModeStr = "Unknown/LegacyPuzzle";
     }
@@ -253,6 +290,15 @@ inline void showFileFullInfo(const std::string &inFilename) {
     std::cout << "Compressed Plaintext Size: " << hdr.originalSize << " bytes\n";
     std::cout << "Search Mode Enum: 0x" << std::hex
               << static_cast<int>(hdr.searchModeEnum) << std::dec << "\n";
+    if (hdr.cipherMode == 0x10 || hdr.cipherMode == 0x12) {
+        std::cout << "Keystream Profile: "
+                  << (hdr.keystreamProfile == 0x00 ? "kdf" : hdr.keystreamProfile == 0x01 ? "xof" : "unknown")
+                  << " (0x" << std::hex << static_cast<int>(hdr.keystreamProfile) << std::dec << ")\n";
+    }
+    if (hdr.cipherMode == 0x12) {
+        std::cout << "Segment Index: " << ((hdr.streamFlags & 0x01) ? "yes" : "no") << "\n";
+        std::cout << "Chunk Tags: " << ((hdr.streamFlags & 0x02) ? "yes" : "no") << "\n";
+    }
     std::cout << "HMAC: ";
     for (auto b : hdr.hmac) {
         std::cout << std::hex << std::setw(2) << std::setfill('0')
@@ -297,7 +343,7 @@ inline std::vector<uint8_t> serializeFileHeader(const FileHeader &hdr) {
 
     // Allocate buffer with enough space
     std::vector<uint8_t> buffer;
-    buffer.reserve(sizeof(ph) + ph.hashNameLen + ph.saltLen);
+    buffer.reserve(sizeof(ph) + ph.hashNameLen + ph.saltLen + 2);
 
     // Append the packed header
     buffer.insert(buffer.end(),
@@ -318,8 +364,21 @@ inline std::vector<uint8_t> serializeFileHeader(const FileHeader &hdr) {
                      reinterpret_cast<const uint8_t*>(hdr.salt.data()) + ph.saltLen);
     }
 
+    // Append extension fields
+    if (hdr.version >= FILE_HEADER_EXT_VERSION) {
+        buffer.push_back(hdr.keystreamProfile);
+        buffer.push_back(hdr.streamFlags);
+    }
+
     return buffer;
 }
 
+// The header bytes a file's HMAC covers: the header with its HMAC field zeroed
+inline std::vector<uint8_t> serializeFileHeaderForHMAC(const FileHeader &hdr) {
+    FileHeader zeroed = hdr;
+    std::fill(zeroed.hmac.begin(), zeroed.hmac.end(), 0x00);
+    return serializeFileHeader(zeroed);
+}
+
 #endif // FILE_HEADER_H
 
@@ -0,0 +1,336 @@
+// mapped-file.h
+
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define RAIN_HAVE_MMAP 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// -------------------------------------------------------------------
+// MappedFile: read-only view of a whole file. Regular files are mmap'd
+// with MADV_SEQUENTIAL so the kernel reads ahead aggressively and bytes
+// are consumed straight from the page cache; pipes, devices and
+// platforms without mmap are read into memory in one piece instead.
+// -------------------------------------------------------------------
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef RAIN_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open file for reading: " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+                ptr_ = static_cast<const uint8_t *>(p);
+                len_ = static_cast<size_t>(st.st_size);
+                mapped_ = true;
+                ::close(fd);
+                return;
+            }
+        }
+        // Not mappable: read it all with large read()s
+        uint8_t buf[1 << 16];
+        while (true) {
+            ssize_t got = ::read(fd, buf, sizeof(buf));
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                ::close(fd);
+                throw std::runtime_error("Failed to read file: " + path);
+            }
+            if (got == 0) break;
+            fallback_.insert(fallback_.end(), buf, buf + got);
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open file for reading: " + path);
+        }
+        char buf[1 << 16];
+        while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+            fallback_.insert(fallback_.end(), buf, buf + in.gcount());
+        }
+#endif
+        ptr_ = fallback_.data();
+        len_ = fallback_.size();
+    }
+
+    ~MappedFile() {
+#ifdef RAIN_HAVE_MMAP
+        if (mapped_) {
+            ::munmap(const_cast<uint8_t *>(ptr_), len_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const { return ptr_; }
+    size_t size() const { return len_; }
+    bool mapped() const { return mapped_; }
+
+private:
+    const uint8_t *ptr_ = nullptr;
+    size_t len_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> fallback_;
+};
+
+// -------------------------------------------------------------------
+// MappedStreamBuf: std::istream over a MappedFile (or any byte range),
+// so istream readers (the chunked stream cipher, HMAC) copy straight
+// out of the mapping instead of through a filebuf.
+// -------------------------------------------------------------------
+class MappedStreamBuf : public std::streambuf {
+public:
+    MappedStreamBuf(const uint8_t *data, size_t size) {
+        char *p = reinterpret_cast<char *>(const_cast<uint8_t *>(data));
+        setg(p, p, p + size);
+    }
+
+protected:
+    std::streamsize xsgetn(char *s, std::streamsize n) override {
+        const std::streamsize avail = egptr() - gptr();
+        const std::streamsize take = n < avail ? n : avail;
+        if (take > 0) {
+            std::memcpy(s, gptr(), static_cast<size_t>(take));
+            setg(eback(), gptr() + take, egptr()); // gbump takes an int, too small past 2 GiB
+        }
+        return take;
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+        char *base = eback();
+        char *target = dir == std::ios_base::beg ? base + off
+                     : dir == std::ios_base::cur ? gptr() + off
+                     : egptr() + off;
+        if (target < base || target > egptr()) return pos_type(off_type(-1));
+        setg(base, target, egptr());
+        return pos_type(target - base);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+// -------------------------------------------------------------------
+// writeFileBytes: replace `path` with `size` bytes. The file is sized
+// up front (fallocate where available) and written with large write()s
+// instead of through an ofstream.
+// -------------------------------------------------------------------
+inline void writeFileBytes(const std::string &path, const uint8_t *data, size_t size) {
+#ifdef RAIN_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open output file: " + path);
+    }
+#if defined(__linux__)
+    if (size > 0) {
+        ::posix_fallocate(fd, 0, static_cast<off_t>(size)); // Best effort; write() still extends the file
+    }
+#endif
+    constexpr size_t WRITE_PIECE = 8 << 20;
+    size_t done = 0;
+    while (done < size) {
+        const size_t want = size - done < WRITE_PIECE ? size - done : WRITE_PIECE;
+        ssize_t put = ::write(fd, data + done, want);
+        if (put < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            throw std::runtime_error("Failed to write output file: " + path);
+        }
+        done += static_cast<size_t>(put);
+    }
+    if (::close(fd) != 0) {
+        throw std::runtime_error("Failed to close output file: " + path);
+    }
+#else
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Cannot open output file: " + path);
+    }
+    out.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+    if (!out.good()) {
+        throw std::runtime_error("Failed to write output file: " + path);
+    }
+#endif
+}
+
+inline void writeFileBytes(const std::string &path, const std::vector<uint8_t> &data) {
+    writeFileBytes(path, data.data(), data.size());
+}
+
+// -------------------------------------------------------------------
+// FileWriteBuf: std::ostream target that writes `path` through a plain
+// fd. Small writes gather in a 1 MiB buffer; anything at least that big
+// (a whole stream frame) goes straight to write() without a copy.
+// -------------------------------------------------------------------
+class FileWriteBuf : public std::streambuf {
+public:
+    explicit FileWriteBuf(const std::string &path) : path_(path), buf_(BUFFER_SIZE) {
+#ifdef RAIN_HAVE_MMAP
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd_ < 0) {
+            throw std::runtime_error("Cannot open output file: " + path);
+        }
+#else
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            throw std::runtime_error("Cannot open output file: " + path);
+        }
+#endif
+        setp(buf_.data(), buf_.data() + buf_.size());
+    }
+
+    ~FileWriteBuf() override {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+
+    FileWriteBuf(const FileWriteBuf &) = delete;
+    FileWriteBuf &operator=(const FileWriteBuf &) = delete;
+
+    // Flush and close; throws if anything failed to reach the file
+    void close() {
+#ifdef RAIN_HAVE_MMAP
+        if (fd_ < 0) return;
+        const bool flushed = drain();
+        const bool closed = ::close(fd_) == 0;
+        fd_ = -1;
+#else
+        if (!file_) return;
+        const bool flushed = drain();
+        const bool closed = std::fclose(file_) == 0;
+        file_ = nullptr;
+#endif
+        if (!flushed || !closed || failed_) {
+            throw std::runtime_error("Failed to write output file: " + path_);
+        }
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!drain()) return traits_type::eof();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        const size_t len = static_cast<size_t>(n);
+        if (len < static_cast<size_t>(epptr() - pptr())) {
+            std::memcpy(pptr(), s, len);
+            pbump(static_cast<int>(len)); // len < BUFFER_SIZE
+            return n;
+        }
+        if (!drain() || !put(s, len)) return 0;
+        return n;
+    }
+
+    int sync() override {
+        return drain() ? 0 : -1;
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    // Write out whatever is buffered
+    bool drain() {
+        const size_t pending = static_cast<size_t>(pptr() - pbase());
+        setp(buf_.data(), buf_.data() + buf_.size());
+        return pending == 0 || put(buf_.data(), pending);
+    }
+
+    bool put(const char *data, size_t size) {
+        if (failed_) return false;
+#ifdef RAIN_HAVE_MMAP
+        size_t done = 0;
+        while (done < size) {
+            ssize_t wrote = ::write(fd_, data + done, size - done);
+            if (wrote < 0) {
+                if (errno == EINTR) continue;
+                failed_ = true;
+                return false;
+            }
+            done += static_cast<size_t>(wrote);
+        }
+#else
+        if (std::fwrite(data, 1, size, file_) != size) {
+            failed_ = true;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    std::string path_;
+    std::vector<char> buf_;
+#ifdef RAIN_HAVE_MMAP
+    int fd_ = -1;
+#else
+    std::FILE *file_ = nullptr;
+#endif
+    bool failed_ = false;
+};
+
+// -------------------------------------------------------------------
+// StagedOutput: write to `path`.part and rename it over `path` on
+// commit(). Left uncommitted (an exception, a failed tag check) the
+// part file is removed, so no partial output is ever left at `path`.
+// -------------------------------------------------------------------
+class StagedOutput {
+public:
+    explicit StagedOutput(const std::string &path) : path_(path), part_(path + ".part") {}
+
+    ~StagedOutput() {
+        if (!committed_) {
+            std::remove(part_.c_str());
+        }
+    }
+
+    StagedOutput(const StagedOutput &) = delete;
+    StagedOutput &operator=(const StagedOutput &) = delete;
+
+    const std::string &partPath() const { return part_; }
+
+    void commit() {
+        if (std::rename(part_.c_str(), path_.c_str()) != 0) {
+            throw std::runtime_error("Cannot move " + part_ + " to " + path_);
+        }
+        committed_ = true;
+    }
+
+private:
+    std::string path_;
+    std::string part_;
+    bool committed_ = false;
+};
+
+#endif // MAPPED_FILE_H
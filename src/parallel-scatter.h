@@ -1,162 +1,156 @@
 #pragma once
-// Result structure:
-struct ParascatterResult {
-  bool found;
-  std::vector<uint8_t> chosenNonce;
+// Parascatter: block-level parallel puzzle search.
+//
+// Every block's subkey is precomputed, so blocks are independent puzzles. One OpenMP
+// region runs for the whole file: each worker claims the next unsearched block and
+// searches it alone; once no unclaimed blocks are left, idle workers join the slowest
+// unsolved blocks (work stealing), so a hard block at the end is not left to a single
+// thread. The first worker to solve a block writes its record straight to that block's
+// fixed position in the output, which reassembles the blocks in order whatever order
+// they finish in.
+
+// One worker's scratch buffers, reused for every trial of every block it searches
+struct ParascatterScratch {
+  std::vector<uint8_t> trial;
+  TrialOutput output;
+  std::vector<uint8_t> nonce;
   std::vector<uint16_t> scatterIndices;
+  ScatterMatcher matcher;
+
+  ParascatterScratch(const HashEngine& engine, size_t subkeySize, size_t nonceSize, uint16_t blockSize,
+                     uint32_t outputExtension)
+    : trial(subkeySize + nonceSize), output(engine, subkeySize + nonceSize, outputExtension),
+      nonce(nonceSize), scatterIndices(blockSize), matcher(blockSize) {}
+
+  void setBlock(const uint8_t* subkey, size_t subkeySize, const uint8_t* block, size_t blockLen) {
+    std::copy(subkey, subkey + subkeySize, trial.begin());
+    matcher.setBlock(block, blockLen);
+  }
+
+  // Hash subkey || nonce (resuming from the subkey midstate) and scatter-match the block
+  // against its output, which is extended only as far as the match needs
+  bool attempt(const PrefixHasher& subkeyPrefix) {
+    std::copy(nonce.begin(), nonce.end(), trial.end() - nonce.size());
+    output.begin(trial.data());
+    subkeyPrefix(nonce.data(), output.data());
+    return matcher.matchForward(output, scatterIndices.data());
+  }
 };
 
-// Parallel scatter function:
-ParascatterResult parallelParascatter(
-    size_t blockIndex,
-    uint16_t thisBlockSize,
-    const std::vector<uint8_t>& block,
-    const std::vector<uint8_t>& blockSubkey,
+// Search state of one block, shared by the workers on it
+struct ParascatterSlot {
+  std::atomic<bool> solved{false};
+  std::atomic<uint32_t> workers{0};
+  std::atomic<uint64_t> nonceCounter{0}; // Deterministic nonces: next counter to try
+};
+
+/**
+ * @brief Solve every block of `compressed` in parascatter mode, writing each block's
+ *        nonce || scatter indices record to `out + blockIndex * (nonceSize + 2 * blockSize)`.
+ *        Workers sharing a block with deterministic nonces take counters from the block's
+ *        shared counter, so they never repeat each other's trials.
+ */
+static void parascatterBlocks(
+    const std::vector<uint8_t>& compressed,
+    uint16_t blockSize,
+    const std::vector<uint8_t>& allSubkeys,
+    size_t subkeySize,
     uint16_t nonceSize,
-    size_t hash_size,
+    const HashEngine& engine,
     uint64_t seed,
-    HashAlgorithm algot,
     bool deterministicNonce,
     uint32_t outputExtension,
-    size_t totalBlocks,
-    bool verbose
+    bool verbose,
+    uint8_t* out
 ) {
-  // 1) Prepare the result
-  ParascatterResult result;
-  result.found = false;
-  result.chosenNonce.resize(nonceSize, 0);
-  result.scatterIndices.resize(thisBlockSize, 0);
-
-  // 2) Shared flag + shared final solution
-  std::atomic<bool> found(false);
-  std::vector<uint8_t> chosenNonceShared(nonceSize);
-  std::vector<uint16_t> scatterIndicesShared(thisBlockSize);
+  const size_t totalBlocks = (compressed.size() + blockSize - 1) / blockSize;
+  const size_t recordSize = nonceSize + static_cast<size_t>(blockSize) * sizeof(uint16_t);
+  std::unique_ptr<ParascatterSlot[]> slots(new ParascatterSlot[totalBlocks]);
+  std::atomic<size_t> nextBlock{0};
+  std::atomic<size_t> solvedBlocks{0};
+  std::atomic<size_t> firstUnsolved{0}; // Hint for stealing: every block before it is solved
+
+  // Claim the next block, or once all are claimed the unsolved block with the fewest workers
+  auto claim = [&](size_t& blockIndex) {
+    blockIndex = nextBlock.fetch_add(1, std::memory_order_relaxed);
+    if (blockIndex < totalBlocks) {
+      return true;
+    }
+    size_t start = firstUnsolved.load(std::memory_order_relaxed);
+    while (start < totalBlocks && slots[start].solved.load(std::memory_order_acquire)) {
+      ++start;
+    }
+    firstUnsolved.store(start, std::memory_order_relaxed);
+    uint32_t fewest = std::numeric_limits<uint32_t>::max();
+    for (size_t b = start; b < totalBlocks; ++b) {
+      if (!slots[b].solved.load(std::memory_order_acquire) && slots[b].workers.load() < fewest) {
+        fewest = slots[b].workers.load();
+        blockIndex = b;
+      }
+    }
+    return fewest != std::numeric_limits<uint32_t>::max();
+  };
 
-  // 3) Launch parallel region
   #pragma omp parallel default(none) \
-    shared(block, blockSubkey, found, chosenNonceShared, scatterIndicesShared, std::cerr) \
-    firstprivate(nonceSize, hash_size, seed, algot, deterministicNonce, blockIndex, thisBlockSize, outputExtension, totalBlocks, verbose)
+    shared(compressed, allSubkeys, engine, slots, nextBlock, solvedBlocks, claim, out, std::cerr) \
+    firstprivate(blockSize, subkeySize, nonceSize, seed, deterministicNonce, outputExtension, verbose, \
+                 totalBlocks, recordSize)
   {
-    // Each thread's preallocated buffers
-    std::vector<uint8_t> localNonce(nonceSize);
-    std::vector<uint16_t> localScatterIndices(thisBlockSize);
+    ParascatterScratch scratch(engine, subkeySize, nonceSize, blockSize, outputExtension);
 
-    // RNG
     RandomFunc randomFunc = selectRandomFunc(RandomConfig::entropyMode);
     RandomGenerator rng = randomFunc();
-    uint64_t nonceCounter = 0;
-
-    // Preallocate 'trial' and 'hashOut' buffers
-    std::vector<uint8_t> trial(blockSubkey.size() + nonceSize);
-    std::copy(blockSubkey.begin(), blockSubkey.end(), trial.begin()); // Copy subkey into trial
-
-    uint8_t resetFlag = 1;
-    std::vector<uint8_t> hashOut(hash_size / 8);
-    std::vector<uint8_t> extendedOutput(outputExtension);
-    std::array<uint8_t, 65536> usedIndices = {};
-    std::vector<uint8_t> finalHashOut;
 
-    uint64_t localTries = 0; // Track number of tries for each thread
-
-    // 4) Main loop
-    while (!found.load(std::memory_order_acquire)) {
-      if (resetFlag == std::numeric_limits<uint8_t>::max()) {
-        std::fill(usedIndices.begin(), usedIndices.end(), 0);
-        resetFlag = 1;
-      } else {
-        ++resetFlag;
-      }
-
-      // Generate nonce
-      if (deterministicNonce) {
-        for (size_t i = 0; i < nonceSize; ++i) {
-          localNonce[i] = static_cast<uint8_t>((nonceCounter >> (i * 8)) & 0xFF);
+    size_t blockIndex = 0;
+    while (claim(blockIndex)) {
+      ParascatterSlot& slot = slots[blockIndex];
+      slot.workers.fetch_add(1);
+
+      const size_t offset = blockIndex * blockSize;
+      const size_t blockLen = std::min<size_t>(blockSize, compressed.size() - offset);
+      const uint8_t* block = compressed.data() + offset;
+      const uint8_t* subkey = allSubkeys.data() + blockIndex * subkeySize;
+      scratch.setBlock(subkey, subkeySize, block, blockLen);
+      const PrefixHasher subkeyPrefix(engine, subkey, subkeySize, nonceSize, seed);
+
+      uint64_t localTries = 0;
+      while (!slot.solved.load(std::memory_order_acquire)) {
+        if (deterministicNonce) {
+          const uint64_t counter = slot.nonceCounter.fetch_add(1, std::memory_order_relaxed);
+          for (size_t i = 0; i < nonceSize; ++i) {
+            scratch.nonce[i] = static_cast<uint8_t>((counter >> (i * 8)) & 0xFF);
+          }
+        } else {
+          rng.as<uint8_t>(nonceSize).swap(scratch.nonce);
         }
-        ++nonceCounter;
-      } else {
-        rng.as<uint8_t>(nonceSize).swap(localNonce);
-        //rng.fill(localNonce.data(), nonceSize);
-      }
-
-      // Build trial buffer
-      std::copy(localNonce.begin(), localNonce.end(),
-                trial.begin() + blockSubkey.size());
 
-      // Hash it
-      invokeHash<bswap>(algot, seed, trial, hashOut, hash_size);
-      finalHashOut = hashOut;
-
-      // Extend hashOut if outputExtension > 0
-      if (outputExtension > 0) {
-        /*
-        std::vector<uint8_t> prk = derivePRK(
-          trial,       // Input key material: subkey || nonce
-          salt,        // Salt
-          blockSubkey, // IKM (shared subkey as an example)
-          algot,       // Hash algorithm
-          hash_size    // Hash size
-        );
-        */
-
-        extendedOutput = extendOutputKDF(
-          trial,             // PRK derived from trial
-          outputExtension, // Additional length
-          algot,           // Hash algorithm
-          hash_size        // Original hash size
-        );
-
-        finalHashOut.insert(finalHashOut.end(), extendedOutput.begin(), extendedOutput.end());
-      }
-
-      // Attempt scatter match
-      bool allFound = true;
-
-      for (size_t byteIdx = 0; byteIdx < thisBlockSize; ++byteIdx) {
-        uint8_t target = block[byteIdx];
-        auto it = std::find(finalHashOut.begin(), finalHashOut.end(), target);
-        while (it != finalHashOut.end()) {
-          size_t idx = static_cast<size_t>(std::distance(finalHashOut.begin(), it));
-          if (usedIndices[idx] != resetFlag) {
-            usedIndices[idx] = resetFlag;
-            localScatterIndices[byteIdx] = static_cast<uint16_t>(idx);
-            break;
+        if (scratch.attempt(subkeyPrefix)) {
+          bool expected = false;
+          if (slot.solved.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            uint8_t* record = out + blockIndex * recordSize;
+            std::copy(scratch.nonce.begin(), scratch.nonce.end(), record);
+            std::memcpy(record + nonceSize, scratch.scatterIndices.data(), blockLen * sizeof(uint16_t));
+            const size_t done = solvedBlocks.fetch_add(1) + 1;
+            if (verbose && (done % 100 == 0 || done == totalBlocks)) {
+              #pragma omp critical
+              std::cerr << "\r[Parascatter] " << done << "/" << totalBlocks << " blocks solved" << std::flush;
+            }
           }
-          it = std::find(std::next(it), finalHashOut.end(), target);
-        }
-        if (it == finalHashOut.end()) {
-          allFound = false;
           break;
         }
-      }
 
-      // If success, mark found & copy results
-       if (verbose && localTries % 100'000 == 0) {
+        if (verbose && ++localTries % 1'000'000 == 0) {
           #pragma omp critical
           {
-              std::cerr << "\r[Parascatter] Block " << blockIndex << "/" << totalBlocks
+            std::cerr << "\r[Parascatter] Block " << blockIndex << "/" << totalBlocks
 #ifdef _OPENMP
-                        << ": Thread " << omp_get_thread_num()
+                      << ": Thread " << omp_get_thread_num()
 #endif
-                        << " reached " << localTries << " tries..." << std::flush;
+                      << " reached " << localTries << " tries..." << std::flush;
           }
-      }
-      ++localTries;
-      if (allFound) {
-        bool expected = false;
-        if (found.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
-          chosenNonceShared = localNonce;
-          scatterIndicesShared = localScatterIndices;
         }
-        break; // This thread can stop
       }
-    } // end while
+      slot.workers.fetch_sub(1);
+    }
   } // end parallel region
-
-  // 5) Fill final result
-  result.found = true; // By now a solution was found if the loop ended
-  result.chosenNonce = chosenNonceShared;
-  result.scatterIndices = scatterIndicesShared;
-
-  return result;
 }
-
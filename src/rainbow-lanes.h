@@ -0,0 +1,201 @@
+// rainbow-lanes.h
+// Multi-key rainbow kernel body. Like rainstorm-lanes.h it has no include guard: rainbow.cpp
+// includes it inside a per-ISA namespace that first defines `Lanes` (vector word, lane mask,
+// lane ops and a tail loader) and RAIN_LANE_TARGET (the matching target attribute).
+
+  RAIN_LANE_TARGET static inline void mixA_lanes(Lanes::V* s) {
+    Lanes::V a = s[0], b = s[1], c = s[2], d = s[3];
+
+    a = Lanes::mul(a, Lanes::set1(P));
+    a = Lanes::rotr<23>(a);
+    a = Lanes::mul(a, Lanes::set1(Q));
+
+    b = Lanes::xor_(b, a);
+
+    b = Lanes::mul(b, Lanes::set1(R));
+    b = Lanes::rotr<29>(b);
+    b = Lanes::mul(b, Lanes::set1(S));
+
+    c = Lanes::mul(c, Lanes::set1(T));
+    c = Lanes::rotr<31>(c);
+    c = Lanes::mul(c, Lanes::set1(U));
+
+    d = Lanes::xor_(d, c);
+
+    d = Lanes::mul(d, Lanes::set1(V));
+    d = Lanes::rotr<37>(d);
+    d = Lanes::mul(d, Lanes::set1(W));
+
+    s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+  }
+
+  RAIN_LANE_TARGET static inline void mixB_lanes(Lanes::V* s, Lanes::V iv) {
+    Lanes::V a = s[1], b = s[2];
+
+    a = Lanes::mul(a, Lanes::set1(V));
+    a = Lanes::rotr<23>(a);
+    a = Lanes::mul(a, Lanes::set1(W));
+
+    b = Lanes::xor_(b, Lanes::add(a, iv));
+
+    b = Lanes::mul(b, Lanes::set1(R));
+    b = Lanes::rotr<23>(b);
+    b = Lanes::mul(b, Lanes::set1(S));
+
+    s[1] = b; s[2] = a;
+  }
+
+  // Groups of Lanes::N keys hashed per call. One group is a single dependency chain through
+  // the vector multiplier (several cycles of latency per multiply), so independent groups
+  // are interleaved to keep it busy.
+  static constexpr size_t GROUPS = 4;
+  static constexpr size_t KEYS = GROUPS * Lanes::N;
+  template <size_t G>
+  RAIN_LANE_TARGET static inline void mixA_groups(Lanes::V (*h)[4]) {
+    for (size_t g = 0; g < G; g++) {
+      mixA_lanes(h[g]);
+    }
+  }
+
+  template <size_t G>
+  RAIN_LANE_TARGET static inline void mixB_groups(Lanes::V (*h)[4], Lanes::V iv) {
+    for (size_t g = 0; g < G; g++) {
+      mixB_lanes(h[g], iv);
+    }
+  }
+
+  // g = -h[2] - h[3] for every key, written at `offset` of each key's digest
+  template <size_t G, bool bswap>
+  RAIN_LANE_TARGET static inline void output_groups(Lanes::V (*h)[4], uint8_t* out, size_t stride, size_t offset) {
+    uint64_t w[Lanes::N];
+    for (size_t g = 0; g < G; g++) {
+      Lanes::store(Lanes::sub(Lanes::sub(Lanes::set1(0), h[g][2]), h[g][3]), w);
+      for (size_t l = 0; l < Lanes::N; l++) {
+        PUT_U64<bswap>(w[l], out + (g * Lanes::N + l) * stride, offset);
+      }
+    }
+  }
+
+  // Hash KEYS keys: key k (group k / N, lane k % N) is lens[k] bytes at keys[k]
+  template <uint32_t hashsize, bool bswap>
+  RAIN_LANE_TARGET static void rainbow_lanes(const uint8_t* const* keys, const size_t* lens, const seed_t seed,
+                                             uint8_t* out) {
+    typedef Lanes::V Vec; // plain V is the rainbow multiplier constant
+    constexpr size_t N = Lanes::N;
+    constexpr size_t stride = hashsize / 8;
+    uint64_t w0[KEYS], w1[KEYS];
+
+    size_t blocks[KEYS];
+    size_t maxBlocks = 0;
+    for (size_t k = 0; k < KEYS; k++) {
+      w0[k] = lens[k];
+      blocks[k] = lens[k] / 16;
+      w1[k] = blocks[k];
+      maxBlocks = std::max(maxBlocks, blocks[k]);
+    }
+
+    const Vec iv = Lanes::set1(seed);
+    Vec blockCount[GROUPS];
+    Vec h[GROUPS][4];
+    for (size_t g = 0; g < GROUPS; g++) {
+      const Vec base = Lanes::add(iv, Lanes::load(w0 + g * N));
+      blockCount[g] = Lanes::load(w1 + g * N);
+      h[g][0] = Lanes::add(base, Lanes::set1(1));
+      h[g][1] = Lanes::add(base, Lanes::set1(2));
+      h[g][2] = Lanes::add(base, Lanes::set1(3));
+      h[g][3] = Lanes::add(base, Lanes::set1(5));
+    }
+
+    // Full blocks. The inner toggle depends only on the block index, so it is shared by all
+    // keys; a key that has run out of blocks keeps its state through the lane mask.
+    for (size_t b = 0; b < maxBlocks; b++) {
+      // Finished keys read a zero block instead
+      for (size_t k = 0; k < KEYS; k++) {
+        const uint8_t* block = zero_unless(b < blocks[k], keys[k] + b * 16);
+        w0[k] = GET_U64<bswap>(block, 0);
+        w1[k] = GET_U64<bswap>(block, 8);
+      }
+
+      Vec n[GROUPS][4];
+      for (size_t g = 0; g < GROUPS; g++) {
+        const Vec g0 = Lanes::load(w0 + g * N), g1 = Lanes::load(w1 + g * N);
+        n[g][0] = Lanes::sub(h[g][0], g0);
+        n[g][1] = Lanes::add(h[g][1], g0);
+        n[g][2] = Lanes::add(h[g][2], g1);
+        n[g][3] = Lanes::sub(h[g][3], g1);
+      }
+
+      if (b & 1) {
+        mixB_groups<GROUPS>(n, iv);
+        for (size_t g = 0; g < GROUPS; g++) {
+          // rotate_right
+          Vec temp = n[g][3];
+          n[g][3] = n[g][2];
+          n[g][2] = n[g][1];
+          n[g][1] = n[g][0];
+          n[g][0] = temp;
+        }
+      } else {
+        mixA_groups<GROUPS>(n);
+      }
+
+      const Vec index = Lanes::set1(b);
+      for (size_t g = 0; g < GROUPS; g++) {
+        const Lanes::M active = Lanes::lt(index, blockCount[g]);
+        for (int i = 0; i < 4; i++) {
+          h[g][i] = Lanes::select(active, n[g][i], h[g][i]);
+        }
+      }
+    }
+
+    mixB_groups<GROUPS>(h, iv);
+
+    // Tail: the scalar switch adds tail byte i to one state word at a fixed shift. Padding the
+    // 0-15 bytes with zeros turns that into the same masked shifts for every key and length.
+    // Only the tail's r bytes are read, without branching on r (lengths are ragged)
+    for (size_t k = 0; k < KEYS; k++) {
+      Lanes::load_tail(keys[k] + blocks[k] * 16, lens[k] & 15, w0[k], w1[k]);
+    }
+    const Vec m0 = Lanes::set1(UINT64_C(0x00FF000000FF0000)); // bytes 2, 6 (and 10, 14 shifted by 8)
+    const Vec m1 = Lanes::set1(UINT64_C(0x0000FF000000FF00)); // bytes 1, 5 (and 9, 13)
+    const Vec m2 = Lanes::set1(UINT64_C(0x000000FF000000FF)); // bytes 0, 4 (and 8, 12)
+    const Vec m3 = Lanes::set1(UINT64_C(0x00000000FF000000)); // byte 3 (and 11); byte 7 goes in unshifted
+    for (size_t g = 0; g < GROUPS; g++) {
+      const Vec lo = Lanes::load(w0 + g * N), hi = Lanes::load(w1 + g * N);
+      h[g][0] = Lanes::add(h[g][0], Lanes::add(Lanes::and_(lo, m0), Lanes::shl<8>(Lanes::and_(hi, m0))));
+      h[g][1] = Lanes::add(h[g][1], Lanes::add(Lanes::and_(lo, m1), Lanes::shl<8>(Lanes::and_(hi, m1))));
+      h[g][2] = Lanes::add(h[g][2], Lanes::add(Lanes::and_(lo, m2), Lanes::shl<8>(Lanes::and_(hi, m2))));
+      h[g][3] = Lanes::add(h[g][3], Lanes::add(Lanes::add(Lanes::and_(lo, m3), Lanes::shr<56>(lo)),
+                                               Lanes::shl<8>(Lanes::and_(hi, m3))));
+    }
+
+    mixA_groups<GROUPS>(h);
+    mixB_groups<GROUPS>(h, iv);
+    mixA_groups<GROUPS>(h);
+    output_groups<GROUPS, bswap>(h, out, stride, 0);
+
+    if (hashsize == 128) {
+      mixA_groups<GROUPS>(h);
+      output_groups<GROUPS, bswap>(h, out, stride, 8);
+    } else if (hashsize == 256) {
+      mixA_groups<GROUPS>(h);
+      output_groups<GROUPS, bswap>(h, out, stride, 8);
+      mixA_groups<GROUPS>(h);
+      mixB_groups<GROUPS>(h, iv);
+      mixA_groups<GROUPS>(h);
+      output_groups<GROUPS, bswap>(h, out, stride, 16);
+      mixA_groups<GROUPS>(h);
+      output_groups<GROUPS, bswap>(h, out, stride, 24);
+    }
+  }
+
+  // Hash as many full batches of KEYS keys as `count` allows and return how many were done.
+  template <uint32_t hashsize, bool bswap>
+  RAIN_LANE_TARGET static size_t rainbow_groups(const uint8_t* const* keys, const size_t* lens, const seed_t seed,
+                                                uint8_t* out, size_t count) {
+    size_t n = 0;
+    for (; n + KEYS <= count; n += KEYS) {
+      rainbow_lanes<hashsize, bswap>(keys + n, lens + n, seed, out + n * (hashsize / 8));
+    }
+    return n;
+  }
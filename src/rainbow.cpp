@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -14,6 +15,10 @@
 
 #include "common.h"
 
+#if defined(RAIN_X86_KERNELS)
+#include <immintrin.h>
+#endif
+
 namespace rainbow {
   static const uint64_t P = UINT64_C(0xFFFFFFFFFFFFFFFF) - 58;
   static const uint64_t Q = UINT64_C(13166748625691186689);
@@ -74,15 +79,37 @@ namespace rainbow {
     s[1] = b; s[2] = a;
   }
 
-  // Streaming state structure if needed (mirroring your original style)
-  struct HashState : IHashState {
+  // Fold the final 0..15 bytes into the state; shared by HashState::finish and rainbow().
+  static inline void absorbTail(uint64_t* h, const uint8_t* tail, size_t len) {
+    switch (len) {
+      case 15: h[0] += (uint64_t)tail[14] << 56; [[fallthrough]];
+      case 14: h[1] += (uint64_t)tail[13] << 48; [[fallthrough]];
+      case 13: h[2] += (uint64_t)tail[12] << 40; [[fallthrough]];
+      case 12: h[3] += (uint64_t)tail[11] << 32; [[fallthrough]];
+      case 11: h[0] += (uint64_t)tail[10] << 24; [[fallthrough]];
+      case 10: h[1] += (uint64_t)tail[9]  << 16; [[fallthrough]];
+      case  9: h[2] += (uint64_t)tail[8]  << 8;  [[fallthrough]];
+      case  8: h[3] += tail[7];                  [[fallthrough]];
+      case  7: h[0] += (uint64_t)tail[6]  << 48; [[fallthrough]];
+      case  6: h[1] += (uint64_t)tail[5]  << 40; [[fallthrough]];
+      case  5: h[2] += (uint64_t)tail[4]  << 32; [[fallthrough]];
+      case  4: h[3] += (uint64_t)tail[3]  << 24; [[fallthrough]];
+      case  3: h[0] += (uint64_t)tail[2]  << 16; [[fallthrough]];
+      case  2: h[1] += (uint64_t)tail[1]  <<  8; [[fallthrough]];
+      case  1: h[2] += (uint64_t)tail[0];
+    }
+  }
+
+  // Incremental hasher: initialize / update (any chunking) / finalize.
+  // As with rainstorm, the total length seeds the state and is declared up front; once
+  // exactly olen bytes have been fed, finalize() matches rainbow<hashsize, bswap>.
+  template <bool bswap>
+  struct HashState : IHashState<HashState<bswap>, 16> {
     uint64_t  h[4];
     seed_t    seed;
-    size_t    len;
+    size_t    olen;
     uint32_t  hashsize;
     bool      inner = false;
-    bool      final_block = false;
-    bool      finalized = false;
 
     static HashState initialize(const seed_t seed, size_t olen, uint32_t hashsize) {
       HashState state;
@@ -90,104 +117,69 @@ namespace rainbow {
       state.h[1] = seed + olen + 2;
       state.h[2] = seed + olen + 3;
       state.h[3] = seed + olen + 5;
-      state.len = 0;
       state.seed = seed;
+      state.olen = olen;
       state.hashsize = hashsize;
       return state;
     }
 
-    void update(const uint8_t* chunk, size_t chunk_len) {
-      while (chunk_len >= 16) {
-        uint64_t g = GET_U64<false>(chunk, 0);
-
-        h[0] -= g;
-        h[1] += g;
-        chunk += 8;
-
-        g = GET_U64<false>(chunk, 0);
-        h[2] += g;
-        h[3] -= g;
-
-        if (inner) {
-          mixB(h, seed);
-          rotate_right(h);
-        } else {
-          mixA(h);
-        }
-        inner = !inner;
-
-        chunk += 8;
-        chunk_len -= 16;
-        len += 16;
-      }
-
-      // Process any remaining data
-      // According to Frank's logic, if there's any remainder it's the final block
-      if (chunk_len >= 0) {
-        final_block = true;
-        mixB(h, seed);
+    void absorb(const uint8_t* block) {
+      uint64_t g = GET_U64<bswap>(block, 0);
+      h[0] -= g;
+      h[1] += g;
 
-        switch (chunk_len) {
-          case 15: h[0] += (uint64_t)chunk[14] << 56; // [[fallthrough]];
-          case 14: h[1] += (uint64_t)chunk[13] << 48; // [[fallthrough]]
-          case 13: h[2] += (uint64_t)chunk[12] << 40; // [[fallthrough]]
-          case 12: h[3] += (uint64_t)chunk[11] << 32; // [[fallthrough]]
-          case 11: h[0] += (uint64_t)chunk[10] << 24; // [[fallthrough]]
-          case 10: h[1] += (uint64_t)chunk[9]  << 16; // [[fallthrough]]
-          case  9: h[2] += (uint64_t)chunk[8]  << 8;  // [[fallthrough]]
-          case  8: h[3] += chunk[7];                  //  [[fallthrough]]
-          case  7: h[0] += (uint64_t)chunk[6]  << 48; // [[fallthrough]]
-          case  6: h[1] += (uint64_t)chunk[5]  << 40; // [[fallthrough]]
-          case  5: h[2] += (uint64_t)chunk[4]  << 32; // [[fallthrough]]
-          case  4: h[3] += (uint64_t)chunk[3]  << 24; // [[fallthrough]]
-          case  3: h[0] += (uint64_t)chunk[2]  << 16; // [[fallthrough]]
-          case  2: h[1] += (uint64_t)chunk[1]  <<  8; // [[fallthrough]]
-          case  1: h[2] += (uint64_t)chunk[0];
-        }
+      g = GET_U64<bswap>(block, 8);
+      h[2] += g;
+      h[3] -= g;
 
-        mixA(h);
+      if (inner) {
         mixB(h, seed);
+        rotate_right(h);
+      } else {
         mixA(h);
-
-        len += chunk_len;
       }
+      inner = !inner;
     }
 
-    void finalize(void* out) {
-      if (finalized) return;
+    void finish(const uint8_t* tail, size_t tailLen, uint8_t* out) {
+      mixB(h, seed);
+
+      absorbTail(h, tail, tailLen);
+
+      mixA(h);
+      mixB(h, seed);
+      mixA(h);
 
       uint64_t g = 0;
       g -= h[2];
       g -= h[3];
-      PUT_U64<false>(g, (uint8_t *)out, 0);
+      PUT_U64<bswap>(g, out, 0);
 
       if (hashsize == 128) {
         mixA(h);
         g = 0;
         g -= h[3];
         g -= h[2];
-        PUT_U64<false>(g, (uint8_t *)out, 8);
+        PUT_U64<bswap>(g, out, 8);
       } else if (hashsize == 256) {
         mixA(h);
         g = 0;
         g -= h[3];
         g -= h[2];
-        PUT_U64<false>(g, (uint8_t *)out, 8);
+        PUT_U64<bswap>(g, out, 8);
         mixA(h);
         mixB(h, seed);
         mixA(h);
         g = 0;
         g -= h[3];
         g -= h[2];
-        PUT_U64<false>(g, (uint8_t *)out, 16);
+        PUT_U64<bswap>(g, out, 16);
         mixA(h);
         g = 0;
         g -= h[3];
         g -= h[2];
-        PUT_U64<false>(g, (uint8_t *)out, 24);
+        PUT_U64<bswap>(g, out, 24);
       }
-
-      finalized = true;
     }
   };
 
@@ -230,23 +222,7 @@ namespace rainbow {
     // After main loop
     mixB(h, seed);
 
-    switch (len) {
-      case 15: h[0] += (uint64_t)data[14] << 56; // [[fallthrough]];
-      case 14: h[1] += (uint64_t)data[13] << 48; // [[fallthrough]]
-      case 13: h[2] += (uint64_t)data[12] << 40; // [[fallthrough]]
-      case 12: h[3] += (uint64_t)data[11] << 32; // [[fallthrough]]
-      case 11: h[0] += (uint64_t)data[10] << 24; // [[fallthrough]]
-      case 10: h[1] += (uint64_t)data[9]  << 16; // [[fallthrough]]
-      case  9: h[2] += (uint64_t)data[8]  << 8;  // [[fallthrough]]
-      case  8: h[3] += data[7];                  //  [[fallthrough]]
-      case  7: h[0] += (uint64_t)data[6]  << 48; // [[fallthrough]]
-      case  6: h[1] += (uint64_t)data[5]  << 40; // [[fallthrough]]
-      case  5: h[2] += (uint64_t)data[4]  << 32; // [[fallthrough]]
-      case  4: h[3] += (uint64_t)data[3]  << 24; // [[fallthrough]]
-      case  3: h[0] += (uint64_t)data[2]  << 16; // [[fallthrough]]
-      case  2: h[1] += (uint64_t)data[1]  <<  8; // [[fallthrough]]
-      case  1: h[2] += (uint64_t)data[0];
-    }
+    absorbTail(h, data, len);
 
     mixA(h);
     mixB(h, seed);
@@ -283,4 +259,74 @@ namespace rainbow {
       PUT_U64<bswap>(g, (uint8_t *)out, 24);
     }
   }
+
+  // Many-keys batch: hash_many hashes independent keys side by side, one per SIMD lane, so
+  // the multiply chains of different keys run in the vector multipliers at the same time.
+  // The kernel body lives in rainbow-lanes.h and is compiled under the ISA's target attribute;
+  // activeSimdKernel() decides at runtime whether it is used. Lane l is bit-identical to
+  // rainbow<hashsize, bswap>(keys[l], lens[l], seed, ...).
+  //
+  // Only AVX-512 gets a kernel: it has a native 64-bit lane multiply (DQ) and masked byte
+  // loads for the ragged tails (BW/VL). With AVX2 the emulated multiply loses to the plain
+  // per-key loop, which the out-of-order core already overlaps well.
+#if defined(RAIN_X86_KERNELS)
+  alignas(16) static const uint8_t ZERO_BLOCK[16] = { 0 };
+
+  // p when take is set, ZERO_BLOCK otherwise. Spelled as mask arithmetic because compilers
+  // tend to turn ?: on pointers into a branch, which mispredicts when key lengths are ragged.
+  static inline const uint8_t* zero_unless(bool take, const uint8_t* p) {
+    const uintptr_t m = (uintptr_t)0 - (uintptr_t)take;
+    return (const uint8_t*)(((uintptr_t)p & m) | ((uintptr_t)ZERO_BLOCK & ~m));
+  }
+
+  namespace avx512 {
+#define RAIN_LANE_TARGET __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl")))
+  struct Lanes {
+    typedef __m512i V;
+    typedef __mmask8 M;
+    static constexpr size_t N = 8;
+    RAIN_LANE_TARGET static inline V set1(uint64_t x) { return _mm512_set1_epi64((long long)x); }
+    RAIN_LANE_TARGET static inline V add(V a, V b) { return _mm512_add_epi64(a, b); }
+    RAIN_LANE_TARGET static inline V sub(V a, V b) { return _mm512_sub_epi64(a, b); }
+    RAIN_LANE_TARGET static inline V xor_(V a, V b) { return _mm512_xor_si512(a, b); }
+    RAIN_LANE_TARGET static inline V and_(V a, V b) { return _mm512_and_si512(a, b); }
+    RAIN_LANE_TARGET static inline V mul(V a, V b) { return _mm512_mullo_epi64(a, b); }
+    // maskz forms with a full mask: same instructions, but they avoid GCC's bogus
+    // -Wuninitialized from the unmasked intrinsics' _mm512_undefined_epi32()
+    template <int n> RAIN_LANE_TARGET static inline V shl(V x) { return _mm512_maskz_slli_epi64((__mmask8)0xFF, x, n); }
+    template <int n> RAIN_LANE_TARGET static inline V shr(V x) { return _mm512_maskz_srli_epi64((__mmask8)0xFF, x, n); }
+    template <int n> RAIN_LANE_TARGET static inline V rotr(V x) { return _mm512_maskz_ror_epi64((__mmask8)0xFF, x, n); }
+    RAIN_LANE_TARGET static inline M lt(V a, V b) { return _mm512_cmplt_epu64_mask(a, b); }
+    RAIN_LANE_TARGET static inline V select(M m, V a, V b) { return _mm512_mask_mov_epi64(b, m, a); }
+    RAIN_LANE_TARGET static inline V load(const uint64_t* w) { return _mm512_loadu_si512((const void*)w); }
+    RAIN_LANE_TARGET static inline void store(V v, uint64_t* w) { _mm512_storeu_si512((void*)w, v); }
+    // The r < 16 tail bytes at p as two little-endian words; masked-off bytes are never read
+    RAIN_LANE_TARGET static inline void load_tail(const uint8_t* p, size_t r, uint64_t& lo, uint64_t& hi) {
+      __m128i t = _mm_maskz_loadu_epi8((__mmask16)((1u << r) - 1), (const void*)p);
+      lo = (uint64_t)_mm_cvtsi128_si64(t);
+      hi = (uint64_t)_mm_extract_epi64(t, 1);
+    }
+  };
+#include "rainbow-lanes.h"
+#undef RAIN_LANE_TARGET
+  }
+#endif
+
+  // Hash `count` independent keys; key i is lens[i] bytes at keys[i] and its hashsize / 8 byte
+  // digest goes to out + i * hashsize / 8. Keys may have any mix of lengths.
+  template <uint32_t hashsize, bool bswap>
+  static void hash_many(const void* const* keys, const size_t* lens, size_t count, const seed_t seed, void* out) {
+    const uint8_t* const* src = (const uint8_t* const*)keys;
+    uint8_t* dst = (uint8_t*)out;
+    constexpr size_t stride = hashsize / 8;
+    size_t n = 0;
+#if defined(RAIN_X86_KERNELS)
+    if (activeSimdKernel() == SimdKernel::AVX512) {
+      n = avx512::rainbow_groups<hashsize, bswap>(src, lens, seed, dst, count);
+    }
+#endif
+    for (; n < count; n++) {
+      rainbow<hashsize, bswap>(src[n], lens[n], seed, dst + n * stride);
+    }
+  }
 }
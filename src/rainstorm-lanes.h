@@ -0,0 +1,114 @@
+// rainstorm-lanes.h
+// Multi-buffer rainstorm kernel body. Deliberately has no include guard: rainstorm.cpp
+// includes it once per ISA, inside a namespace that first defines `Lanes` (vector word and
+// lane ops) and RAIN_LANE_TARGET (the matching target attribute). Every function here
+// carries that attribute so intrinsics inline into it without enabling the ISA globally.
+
+  RAIN_LANE_TARGET static inline void weakfunc_lanes(Lanes::V* h, const Lanes::V* data, bool left) {
+    Lanes::V ctr;
+    if (left) {
+      ctr = Lanes::set1(CTR_LEFT);
+      for (int i = 0, j = 1, k = 8; i < 8; i++, j++, k++) {
+        h[i] = Lanes::xor_(h[i], data[i]);
+        h[i] = Lanes::sub(h[i], Lanes::set1(K[i]));
+        h[i] = Lanes::rotr(h[i], Z[i]);
+
+        h[k] = Lanes::xor_(h[k], h[i]);
+
+        ctr = Lanes::add(ctr, h[i]);
+        h[j] = Lanes::sub(h[j], ctr);
+      }
+    } else {
+      ctr = Lanes::set1(CTR_RIGHT);
+      for (int i = 8, j = 0, k = 1; i < 16; i++, j++, k++) {
+        h[i] = Lanes::xor_(h[i], data[j]);
+        h[i] = Lanes::sub(h[i], Lanes::set1(K[j]));
+        h[i] = Lanes::rotr(h[i], Z[j]);
+
+        h[j] = Lanes::xor_(h[j], h[i]);
+
+        ctr = Lanes::add(ctr, h[i]);
+        h[(k & 7) + 8] = Lanes::sub(h[(k & 7) + 8], ctr);
+      }
+    }
+  }
+
+  // Transpose one 64-byte block from each of the Lanes::N messages into eight lane vectors
+  template <bool bswap>
+  RAIN_LANE_TARGET static inline void load_lanes(Lanes::V* temp, const uint8_t* const* data, size_t offset) {
+    uint64_t w[Lanes::N];
+    for (int i = 0; i < 8; i++) {
+      for (size_t l = 0; l < Lanes::N; l++) {
+        w[l] = GET_U64<bswap>(data[l], offset + i * 8);
+      }
+      temp[i] = Lanes::gather(w);
+    }
+  }
+
+  template <uint32_t hashsize, bool bswap>
+  RAIN_LANE_TARGET static void rainstorm_lanes(const uint8_t* const* in, const size_t len, const seed_t seed, uint8_t* const* out) {
+    typedef Lanes::V V;
+    static const uint64_t IV[16] = { 1, 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47 };
+    V h[16];
+    for (int i = 0; i < 16; i++) {
+      h[i] = Lanes::set1(seed + len + IV[i]);
+    }
+
+    V temp[8];
+    size_t offset = 0;
+    size_t lenRemaining = len;
+
+    while (lenRemaining >= 64) {
+      load_lanes<bswap>(temp, in, offset);
+
+      for (int i = 0; i < ROUNDS; i++) {
+        weakfunc_lanes(h, temp, i & 1);
+      }
+
+      offset += 64;
+      lenRemaining -= 64;
+    }
+
+    // Pad each lane's tail exactly as the scalar version does
+    uint8_t tail[Lanes::N][64];
+    const uint8_t* tails[Lanes::N];
+    for (size_t l = 0; l < Lanes::N; l++) {
+      memset(tail[l], (0x80 + lenRemaining) & 255, 64);
+      memcpy(tail[l], in[l] + offset, lenRemaining);
+      tails[l] = tail[l];
+    }
+    load_lanes<false>(temp, tails, 0);
+
+    for (int i = 0; i < ROUNDS; i++) {
+      weakfunc_lanes(h, temp, i & 1);
+    }
+
+    for (int i = 0, j = 8; i < 8; i++, j++) {
+      h[i] = Lanes::sub(h[i], h[j]);
+    }
+
+    if (hashsize > 64) {
+      for (int i = 0; i < std::max((int)hashsize / 64, FINAL_ROUNDS); i++) {
+        weakfunc_lanes(h, temp, true);
+      }
+    }
+
+    uint64_t w[Lanes::N];
+    for (uint32_t i = 0, j = 0; i < std::min((uint32_t)8, hashsize / 64); i++, j += 8) {
+      Lanes::scatter(h[i], w);
+      for (size_t l = 0; l < Lanes::N; l++) {
+        PUT_U64<bswap>(w[l], out[l], j);
+      }
+    }
+  }
+
+  // Hash as many full groups of Lanes::N as `count` allows and return how many were done.
+  template <uint32_t hashsize, bool bswap>
+  RAIN_LANE_TARGET static size_t rainstorm_groups(const uint8_t* const* src, const size_t len, const seed_t seed,
+                                                  uint8_t* const* dst, size_t count) {
+    size_t n = 0;
+    for (; n + Lanes::N <= count; n += Lanes::N) {
+      rainstorm_lanes<hashsize, bswap>(src + n, len, seed, dst + n);
+    }
+    return n;
+  }
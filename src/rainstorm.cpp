@@ -21,6 +21,10 @@
 
 #include "common.h"
 
+#if defined(RAIN_X86_KERNELS)
+#include <immintrin.h>
+#endif
+
 namespace rainstorm {
   // Frank's fixes: use static constexpr for these constants
   static constexpr int ROUNDS = 4;
@@ -80,107 +84,77 @@ namespace rainstorm {
   }
   */
 
-  struct HashState : IHashState {
-    uint64_t  start[16];
+  // Incremental hasher: initialize / update (any chunking) / finalize.
+  // The total length is mixed into the initial state, so it is declared up front in
+  // initialize(); once exactly olen bytes have been fed, finalize() gives the same digest
+  // as rainstorm<hashsize, bswap>(data, olen, seed, out).
+  template <bool bswap>
+  struct HashState : IHashState<HashState<bswap>, 64> {
     uint64_t  h[16];
     seed_t    seed;
-    size_t    len;             
     size_t    olen;
     uint32_t  hashsize;
-    bool      inner = 0;
-    bool      final_block = false;
-    bool      finalized = false;
 
     static HashState initialize(const seed_t seed, size_t olen, uint32_t hashsize) {
       HashState state;
 
-      state.h[0]  = state.start[0] = seed + olen + 1;
-      state.h[1]  = state.start[1] = seed + olen + 2;
-      state.h[2]  = state.start[2] = seed + olen + 2;
-      state.h[3]  = state.start[3] = seed + olen + 3;
-      state.h[4]  = state.start[4] = seed + olen + 5;
-      state.h[5]  = state.start[5] = seed + olen + 7;
-      state.h[6]  = state.start[6] = seed + olen + 11;
-      state.h[7]  = state.start[7] = seed + olen + 13;
-      state.h[8]  = state.start[8] = seed + olen + 17;
-      state.h[9]  = state.start[9] = seed + olen + 19;
-      state.h[10] = state.start[10] = seed + olen + 23;
-      state.h[11] = state.start[11] = seed + olen + 29;
-      state.h[12] = state.start[12] = seed + olen + 31;
-      state.h[13] = state.start[13] = seed + olen + 37;
-      state.h[14] = state.start[14] = seed + olen + 41;
-      state.h[15] = state.start[15] = seed + olen + 43;
-
-      state.len = 0;  
+      state.h[0]  = seed + olen + 1;
+      state.h[1]  = seed + olen + 2;
+      state.h[2]  = seed + olen + 3;
+      state.h[3]  = seed + olen + 5;
+      state.h[4]  = seed + olen + 7;
+      state.h[5]  = seed + olen + 11;
+      state.h[6]  = seed + olen + 13;
+      state.h[7]  = seed + olen + 17;
+      state.h[8]  = seed + olen + 19;
+      state.h[9]  = seed + olen + 23;
+      state.h[10] = seed + olen + 29;
+      state.h[11] = seed + olen + 31;
+      state.h[12] = seed + olen + 37;
+      state.h[13] = seed + olen + 41;
+      state.h[14] = seed + olen + 43;
+      state.h[15] = seed + olen + 47;
+
       state.seed = seed;
       state.olen = olen;
       state.hashsize = hashsize;
       return state;
     }
 
-    void update(const uint8_t* chunk, size_t chunk_len) {
+    void absorb(const uint8_t* block) {
       uint64_t temp[8];
-      if (this->final_block) {
-        // can't update after final block
-        return;
+      for (int i = 0, j = 0; i < 8; ++i, j += 8) {
+        temp[i] = GET_U64<bswap>(block, j);
       }
 
-      while (chunk_len >= 64) {
-        for (int i = 0, j = 0; i < 8; ++i, j += 8) {
-          temp[i] = GET_U64<false>(chunk, j);
-        }
-
-        for (int i = 0; i < ROUNDS; i++) {
-          weakfunc(this->h, temp, i & 1);
-        }
-
-        //compress1(this->h, this->start, seed);
-
-        chunk += 64;
-        chunk_len -= 64;
-        this->len += 64;
+      for (int i = 0; i < ROUNDS; i++) {
+        weakfunc(h, temp, i & 1);
       }
+    }
 
-      if (chunk_len >= 0 || this->olen == 0) {
-        // Pad the remaining data
-        memset(temp, (0x80 + chunk_len) & 255, sizeof(temp));
-        memcpy(temp, chunk, chunk_len);
-        // Frank's fix: Don't perform the length encoding that can cause issues:
-        // temp[lenRemaining >> 3] |= (uint64_t)(lenRemaining << ((lenRemaining&7)*8)); 
-        // was removed in Frank's code.
-
-        //compress1(this->h, this->start, seed);
-
-        for (int i = 0; i < ROUNDS; i++) {
-          weakfunc(this->h, temp, i & 1);
-        }
-
-        for (int i = 0, j = 8; i < 8; i++, j++) {
-          h[i] -= h[j];
-        }
-
-        // If hashsize > 64, do final rounds as Frank does:
-        if (hashsize > 64) {
-          for (int i = 0; i < std::max((int)hashsize / 64, FINAL_ROUNDS); i++) {
-            weakfunc(h, temp, true);
-          }
-        }
+    void finish(const uint8_t* tail, size_t tailLen, uint8_t* out) {
+      // Pad the buffered tail exactly as the one-shot version does
+      uint64_t temp[8];
+      memset(temp, (0x80 + tailLen) & 255, sizeof(temp));
+      memcpy(temp, tail, tailLen);
 
-        this->len += chunk_len;
-        this->final_block = true;
+      for (int i = 0; i < ROUNDS; i++) {
+        weakfunc(h, temp, i & 1);
       }
-    }
 
-    void finalize(void* out) {
-      if (finalized) {
-        return;
+      for (int i = 0, j = 8; i < 8; i++, j++) {
+        h[i] -= h[j];
       }
 
-      for (int i = 0, j = 0; i < std::min((int)8, (int)this->hashsize / 64); i++, j += 8) {
-        PUT_U64<false>(h[i], (uint8_t *)out, j);
+      if (hashsize > 64) {
+        for (int i = 0; i < std::max((int)hashsize / 64, FINAL_ROUNDS); i++) {
+          weakfunc(h, temp, true);
+        }
       }
 
-      finalized = true;
+      for (int i = 0, j = 0; i < std::min((int)8, (int)hashsize / 64); i++, j += 8) {
+        PUT_U64<bswap>(h[i], out, j);
+      }
     }
   };
 
@@ -249,4 +223,76 @@ namespace rainstorm {
       PUT_U64<bswap>(h[i], (uint8_t *)out, j);
     }
   }
+
+  // Multi-buffer rainstorm: N equal-length messages are hashed side by side, one per SIMD lane.
+  // Every lane runs exactly the scalar schedule above, so lane l of the output is bit-identical
+  // to rainstorm<hashsize, bswap>(in[l], len, seed, out[l]).
+  //
+  // A lane type provides the vector word V, its width N, and the handful of 64-bit lane ops
+  // the round function needs (add, sub, xor, rotate right). Each ISA gets its own namespace
+  // with the kernel body from rainstorm-lanes.h compiled under that ISA's target attribute,
+  // so the binary itself stays baseline x86-64 and activeSimdKernel() picks one at runtime.
+#if defined(RAIN_X86_KERNELS)
+  namespace avx512 {
+#define RAIN_LANE_TARGET __attribute__((target("avx512f")))
+  struct Lanes {
+    typedef __m512i V;
+    static constexpr size_t N = 8;
+    RAIN_LANE_TARGET static inline V set1(uint64_t x) { return _mm512_set1_epi64((long long)x); }
+    RAIN_LANE_TARGET static inline V add(V a, V b) { return _mm512_add_epi64(a, b); }
+    RAIN_LANE_TARGET static inline V sub(V a, V b) { return _mm512_sub_epi64(a, b); }
+    RAIN_LANE_TARGET static inline V xor_(V a, V b) { return _mm512_xor_si512(a, b); }
+    RAIN_LANE_TARGET static inline V rotr(V x, uint64_t n) { return _mm512_maskz_rorv_epi64((__mmask8)0xFF, x, set1(n)); }
+    RAIN_LANE_TARGET static inline V gather(const uint64_t* w) { return _mm512_loadu_si512((const void*)w); }
+    RAIN_LANE_TARGET static inline void scatter(V v, uint64_t* w) { _mm512_storeu_si512((void*)w, v); }
+  };
+#include "rainstorm-lanes.h"
+#undef RAIN_LANE_TARGET
+  }
+
+  namespace avx2 {
+#define RAIN_LANE_TARGET __attribute__((target("avx2")))
+  struct Lanes {
+    typedef __m256i V;
+    static constexpr size_t N = 4;
+    RAIN_LANE_TARGET static inline V set1(uint64_t x) { return _mm256_set1_epi64x((long long)x); }
+    RAIN_LANE_TARGET static inline V add(V a, V b) { return _mm256_add_epi64(a, b); }
+    RAIN_LANE_TARGET static inline V sub(V a, V b) { return _mm256_sub_epi64(a, b); }
+    RAIN_LANE_TARGET static inline V xor_(V a, V b) { return _mm256_xor_si256(a, b); }
+    RAIN_LANE_TARGET static inline V rotr(V x, uint64_t n) {
+      return _mm256_or_si256(_mm256_srl_epi64(x, _mm_cvtsi64_si128((long long)n)),
+                             _mm256_sll_epi64(x, _mm_cvtsi64_si128((long long)(64 - n))));
+    }
+    RAIN_LANE_TARGET static inline V gather(const uint64_t* w) { return _mm256_loadu_si256((const __m256i*)w); }
+    RAIN_LANE_TARGET static inline void scatter(V v, uint64_t* w) { _mm256_storeu_si256((__m256i*)w, v); }
+  };
+#include "rainstorm-lanes.h"
+#undef RAIN_LANE_TARGET
+  }
+#endif
+
+  // Hash `count` messages that all share the same length and seed. Full groups go through
+  // the multi-buffer kernel selected at startup (8 lanes, then 4), any remainder through the
+  // scalar template.
+  template <uint32_t hashsize, bool bswap>
+  static void rainstorm_xN(const void* const* in, const size_t len, const seed_t seed, void* const* out, size_t count) {
+    const uint8_t* const* src = (const uint8_t* const*)in;
+    uint8_t* const* dst = (uint8_t* const*)out;
+    size_t n = 0;
+#if defined(RAIN_X86_KERNELS)
+    switch (activeSimdKernel()) {
+      case SimdKernel::AVX512:
+        n += avx512::rainstorm_groups<hashsize, bswap>(src + n, len, seed, dst + n, count - n);
+        [[fallthrough]];
+      case SimdKernel::AVX2:
+        n += avx2::rainstorm_groups<hashsize, bswap>(src + n, len, seed, dst + n, count - n);
+        break;
+      default:
+        break;
+    }
+#endif
+    for (; n < count; n++) {
+      rainstorm<hashsize, bswap>(src[n], len, seed, dst[n]);
+    }
+  }
 }
@@ -7,6 +7,7 @@
 #include "file-header.h"
 #include "block-cipher.h"
 #include "stream-cipher.h"
+#include "bench.h"
 
 // =================================================================
 // ADDED: Main Function with Additions Only
@@ -38,10 +39,16 @@ int main(int argc, char** argv) {
 #else
                 cxxopts::value<std::string>()->default_value("scatter"))
 #endif
-            ("o,output-file", "Output file (stream mode)",
+            ("o,output-file", "Output file (stream mode; stream-enc / dec of '-' (stdin))",
                 cxxopts::value<std::string>()->default_value("/dev/stdout"))
             ("t,test-vectors", "Calculate the hash of the standard test vectors",
                 cxxopts::value<bool>()->default_value("false"))
+            ("tree", "Digest mode: hash 1 MiB leaves in parallel and combine them into a tree root (RainTree v1)",
+                cxxopts::value<bool>()->default_value("false"))
+            ("bench", "Benchmark the hashes (cycles/byte, GB/s, small-key latency) and exit; -a / -s narrow it",
+                cxxopts::value<bool>()->default_value("false"))
+            ("bench-format", "Benchmark output: table or json",
+                cxxopts::value<std::string>()->default_value("table"))
             ("l,output-length", "Output length in hash iterations (stream mode)",
                 cxxopts::value<uint64_t>()->default_value("1000000"))
             ("x,output-extension", "Output extension in bytes (block-enc mode). Extend digest by this many bytes to make mining larger P blocks faster",
@@ -60,6 +67,16 @@ int main(int argc, char** argv) {
                 cxxopts::value<std::string>()->default_value(""))
             ("key-material", "Path to a file whose contents will be hashed to derive the encryption/decryption key",
                 cxxopts::value<std::string>()->default_value(""))
+            ("keystream", "Stream-enc keystream profile: kdf (8 hash rounds per block) or xof (4, about twice as fast)",
+                cxxopts::value<std::string>()->default_value("kdf"))
+            ("threads", "Stream-enc worker threads for deflate and keystream (0 = one per core)",
+                cxxopts::value<unsigned>()->default_value("0"))
+            ("no-index", "Stream-enc: omit the segment index that dec --range needs",
+                cxxopts::value<bool>()->default_value("false"))
+            ("range", "Dec: decrypt only plaintext bytes A-B (inclusive; A- for the rest) of an indexed stream file",
+                cxxopts::value<std::string>()->default_value(""))
+            ("kernel", "SIMD kernel: auto (widest the CPU supports), scalar, avx2, avx512",
+                cxxopts::value<std::string>()->default_value("auto"))
             ("noop", "Noop flag useful for testing as a placeholder",
                 cxxopts::value<bool>()->default_value("false"))
             // ADDED: verbose
@@ -77,13 +94,20 @@ int main(int argc, char** argv) {
             return 0;
         }
 
+        selectSimdKernel(result["kernel"].as<std::string>());
+
         if (result.count("version")) {
             std::cerr << "rainsum version: " << VERSION << "\n"; // Replace with actual VERSION
+            std::cerr << "kernel: " << simdKernelName(activeSimdKernel())
+                      << " (detected: " << simdKernelName(detectSimdKernel()) << ")\n";
             return 0;
         }
 
         // ADDED: verbose
         bool verbose = result["verbose"].as<bool>();
+        if (verbose) {
+            std::cerr << "[Info] Hash kernel: " << simdKernelName(activeSimdKernel()) << "\n";
+        }
 
         // Access and validate options
 
@@ -113,24 +137,18 @@ int main(int argc, char** argv) {
 
         if ( mode == Mode::BlockEnc || mode == Mode::StreamEnc || mode == Mode::Dec ) {
           if (!keyMaterialPath.empty()) {
-              // Read the file contents
-              std::ifstream keyFile(keyMaterialPath, std::ios::binary);
-              if (!keyFile.is_open()) {
-                  throw std::runtime_error("Unable to open key material file: " + keyMaterialPath);
-              }
-              std::vector<uint8_t> fileData((std::istreambuf_iterator<char>(keyFile)),
-                                            (std::istreambuf_iterator<char>()));
-              keyFile.close();
-
-              // Hash the file contents to derive a 512-bit key
+              // Hash the file contents (streamed, constant memory) to derive a 512-bit key
               key_input_enc.resize(512 / 8);
-              rainstorm::rainstorm<512, bswap>(fileData.data(), fileData.size(), 0, key_input_enc.data());
+              digestFile(HashAlgorithm::Rainstorm, keyMaterialPath, 0, 512, key_input_enc.data());
               if (verbose) {
                   std::cerr << "[Info] Derived 512-bit key from file: " << keyMaterialPath << "\n";
               }
           } else {
               // Fallback to password-based key derivation
               if (password.empty()) {
+                  if (!result.unmatched().empty() && result.unmatched().front() == "-") {
+                      throw std::runtime_error("Input '-' is read from stdin, so give the key with -P or --key-material.");
+                  }
                   password = promptForKey("Enter encryption key: ");
               }
               key_input_enc.assign(password.begin(), password.end());
@@ -146,6 +164,14 @@ int main(int argc, char** argv) {
             throw std::runtime_error("Unsupported algorithm string: " + algorithm);
         }
 
+        // Benchmark: every hash unless -a / -s were given explicitly
+        if (result["bench"].as<bool>()) {
+            bench::run(result.count("algorithm") ? algot : HashAlgorithm::Unknown,
+                       result.count("size") ? hash_size : 0,
+                       result["bench-format"].as<std::string>(), std::cout);
+            return 0;
+        }
+
         // Validate Hash Size based on Algorithm
         if (algot == HashAlgorithm::Rainbow) {
             if (hash_size == 512) {
@@ -275,6 +301,12 @@ int main(int argc, char** argv) {
         // Test Vectors
         bool use_test_vectors = result["test-vectors"].as<bool>();
 
+        // Tree digest
+        bool tree = result["tree"].as<bool>();
+        if (tree && mode != Mode::Digest) {
+            throw std::runtime_error("--tree is only available in digest mode.");
+        }
+
         // Output Length
         uint64_t output_length = result["output-length"].as<uint64_t>();
 
@@ -358,11 +390,28 @@ int main(int argc, char** argv) {
         std::string outpath_enc = result["output-file"].as<std::string>();
         // We'll write ciphertext to inpath + ".rc"
         std::string encFile = inpath + ".rc";
+        // "-": stream-enc / dec read stdin and write the output file (stdout by default)
+        const bool piped = inpath == "-";
+        std::unique_ptr<FileWriteBuf> pipeBuf;
+        std::ostream pipeFile(nullptr);
+        auto pipeOutput = [&]() -> std::ostream& {
+            if (outpath_enc == "/dev/stdout") {
+                return std::cout;
+            }
+            pipeBuf = std::make_unique<FileWriteBuf>(outpath_enc);
+            pipeFile.rdbuf(pipeBuf.get());
+            return pipeFile;
+        };
+        auto closePipeOutput = [&]() {
+            if (pipeBuf) {
+                pipeBuf->close();
+            }
+        };
 
         if (mode == Mode::Digest) {
             // Just a normal digest
             if (outpath_enc == "/dev/stdout") {
-                hashAnything(Mode::Digest, algot, inpath, std::cout, hash_size, use_test_vectors, seed, output_length);
+                hashAnything(Mode::Digest, algot, inpath, std::cout, hash_size, use_test_vectors, seed, output_length, tree);
             }
             else {
                 std::ofstream outfile(outpath_enc, std::ios::binary);
@@ -370,7 +419,7 @@ int main(int argc, char** argv) {
                     std::cerr << "Failed to open output file: " << outpath_enc << std::endl;
                     return 1;
                 }
-                hashAnything(Mode::Digest, algot, inpath, outfile, hash_size, use_test_vectors, seed, output_length);
+                hashAnything(Mode::Digest, algot, inpath, outfile, hash_size, use_test_vectors, seed, output_length, tree);
             }
         }
         else if (mode == Mode::Stream) {
@@ -406,6 +455,20 @@ int main(int argc, char** argv) {
             puzzleEncryptFileWithHeader(inpath, encFile, keyVec_enc, algot, hash_size, seed, salt, blockSize, nonceSize, searchMode, verbose, deterministicNonce, output_extension);
             std::cerr << "[Enc] Wrote encrypted file to: " << encFile << "\n";
         }
+        else if (mode == Mode::StreamEnc && piped) {
+            // Size unknown up front: per-chunk tags instead of a patched-in HMAC, one forward pass
+            unsigned threads = result["threads"].as<unsigned>();
+            if (threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            streamEncryptChunked(getInputStream(), STREAM_UNKNOWN_SIZE, pipeOutput(), keyVec_enc, algot,
+                                 hash_size, seed, salt, output_extension, verbose,
+                                 getKeystreamProfile(result["keystream"].as<std::string>()), threads, false);
+            closePipeOutput();
+            if (verbose) {
+                std::cerr << "[StreamEnc] Wrote tagged stream from stdin to: " << outpath_enc << "\n";
+            }
+        }
         else if (mode == Mode::StreamEnc) {
             if (inpath.empty()) {
                 throw std::runtime_error("No input file specified for encryption.");
@@ -422,6 +485,11 @@ int main(int argc, char** argv) {
                 throw std::runtime_error("Error while overwriting existing encrypted file: " + std::string(e.what()));
             }
 
+            unsigned threads = result["threads"].as<unsigned>();
+            if (threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+
             // ADDED: Call streamEncryptFileWithHeader
             streamEncryptFileWithHeader(
                 inpath,
@@ -432,10 +500,53 @@ int main(int argc, char** argv) {
                 seed,          // Using seed as IV
                 salt,          // Using provided salt
                 output_extension,
-                verbose
+                verbose,
+                getKeystreamProfile(result["keystream"].as<std::string>()),
+                threads,
+                !result["no-index"].as<bool>()
             );
             std::cerr << "[StreamEnc] Wrote encrypted file to: " << encFile << "\n";
         }
+        else if (mode == Mode::Dec && piped) {
+            if (!result["range"].as<std::string>().empty()) {
+                throw std::runtime_error("[Dec] --range needs a seekable file, not stdin.");
+            }
+            std::istream &fin_pipe = getInputStream();
+            FileHeader hdr_pipe = readFileHeader(fin_pipe);
+            if (hdr_pipe.magic != MagicNumber) {
+                throw std::runtime_error("[Dec] Invalid magic number in header.");
+            }
+            if (hdr_pipe.cipherMode != STREAM_CHUNKED_MODE || !(hdr_pipe.streamFlags & STREAM_FLAG_CHUNK_TAGS)) {
+                throw std::runtime_error("[Dec] Only streams encrypted from stdin (per-chunk tags) can be decrypted "
+                                         "from stdin; decrypt other files by path.");
+            }
+            // Each chunk is written only after its tag verifies
+            streamDecryptChunked(fin_pipe, hdr_pipe, pipeOutput(), keyVec_enc, verbose);
+            closePipeOutput();
+            if (verbose) {
+                std::cerr << "[Dec] Chunk tags verified; wrote plaintext to: " << outpath_enc << "\n";
+            }
+        }
+        else if (mode == Mode::Dec && !result["range"].as<std::string>().empty()) {
+            if (inpath.empty()) {
+                throw std::runtime_error("No ciphertext file specified for decryption.");
+            }
+
+            // Partial decryption reads only the index and the chunks in range, so the
+            // whole-file HMAC is replaced by the index tag and per-chunk tags
+            uint64_t first = 0, last = 0;
+            parseByteRange(result["range"].as<std::string>(), first, last);
+            std::string decFile = inpath + ".dec";
+            // Staged like a full dec: nothing reaches decFile unless every chunk in range verifies
+            StagedOutput staged(decFile);
+            FileWriteBuf rangeBuf(staged.partPath());
+            std::ostream fout_range(&rangeBuf);
+            uint64_t written = streamDecryptRange(inpath, first, last, fout_range, keyVec_enc, verbose);
+            rangeBuf.close();
+            staged.commit();
+            std::cerr << "[Dec] Segment index and chunk tags verified.\n";
+            std::cerr << "[Dec] Wrote " << written << " plaintext bytes to: " << decFile << "\n";
+        }
         else if (mode == Mode::Dec) {
             if (inpath.empty()) {
                 throw std::runtime_error("No ciphertext file specified for decryption.");
@@ -444,50 +555,28 @@ int main(int argc, char** argv) {
             // We'll write plaintext to inpath + ".dec"
             std::string decFile = inpath + ".dec";
 
-            // ======== HMAC Verification ========
-            // 1. Open the encrypted file to read header and ciphertext
+            // The header picks the decryptor. Each one reads the ciphertext once, checks the
+            // HMAC (or chunk tags) in that pass and only renames decFile.part into place once
+            // the tag verifies
             std::ifstream fin_dec(inpath, std::ios::binary);
             if (!fin_dec.is_open()) {
                 throw std::runtime_error("[Dec] Cannot open ciphertext file: " + inpath);
             }
-
-            // 2. Read the header
             FileHeader hdr_dec = readFileHeader(fin_dec);
-
-            // 3. Read the ciphertext (rest of the file after header)
-            std::vector<uint8_t> ciphertext_dec(
-                (std::istreambuf_iterator<char>(fin_dec)),
-                (std::istreambuf_iterator<char>())
-            );
             fin_dec.close();
 
-            // 4. Backup the stored HMAC
-            std::vector<uint8_t> storedHMAC_vec(hdr_dec.hmac.begin(), hdr_dec.hmac.end());
-
-            // 5. Serialize the header with zeroed HMAC for HMAC computation
-            FileHeader hdr_dec_for_hmac = hdr_dec;
-            std::fill(hdr_dec_for_hmac.hmac.begin(), hdr_dec_for_hmac.hmac.end(), 0x00);
-            std::vector<uint8_t> headerData_dec = serializeFileHeader(hdr_dec_for_hmac);
-
-            // 6. Convert key_input to vector<uint8_t>
-            std::vector<uint8_t> keyVec_dec(key_input_enc.begin(), key_input_enc.end());
-
-            // 7. Compute HMAC
-            auto computedHMAC_dec = createHMAC(headerData_dec, ciphertext_dec, keyVec_dec);
-
-            // 8. Verify HMAC
-            if (!verifyHMAC(headerData_dec, ciphertext_dec, keyVec_dec, storedHMAC_vec)) {
-                throw std::runtime_error("[Dec] HMAC verification failed! File may be corrupted or tampered with.");
-            }
-            else {
-                std::cerr << "[Dec] HMAC verification succeeded.\n";
-            }
-
             if (hdr_dec.magic != MagicNumber) {
                 throw std::runtime_error("[Dec] Invalid magic number in header.");
             }
 
-            if (hdr_dec.cipherMode == 0x10) { // Stream Cipher Mode
+            std::vector<uint8_t> keyVec_dec(key_input_enc.begin(), key_input_enc.end());
+            const bool chunkTags_dec = hdr_dec.cipherMode == STREAM_CHUNKED_MODE
+                                       && (hdr_dec.streamFlags & STREAM_FLAG_CHUNK_TAGS);
+            const char *verified_dec = chunkTags_dec ? "[Dec] Chunk tags verified.\n"
+                                     : hdr_dec.cipherMode == STREAM_CHUNKED_MODE ? "[Dec] File tag verified.\n"
+                                     : "[Dec] HMAC verification succeeded.\n";
+
+            if (hdr_dec.cipherMode == 0x10 || hdr_dec.cipherMode == STREAM_CHUNKED_MODE) { // Stream Cipher Mode
                 // ADDED: Stream Decryption
                 streamDecryptFileWithHeader(
                     inpath,
@@ -495,11 +584,13 @@ int main(int argc, char** argv) {
                     keyVec_dec,
                     verbose
                 );
+                std::cerr << verified_dec;
                 std::cerr << "[Dec] Wrote decrypted plaintext to: " << decFile << "\n";
             }
             else if (hdr_dec.cipherMode == 0x11) { // Block Cipher Mode
                 // ADDED: Block Decryption (integration with tool.h assumed)
                 puzzleDecryptFileWithHeader(inpath, decFile, keyVec_dec);
+                std::cerr << verified_dec;
                 std::cerr << "[Dec] Wrote decrypted plaintext to: " << decFile << "\n";
             }
             else {
@@ -507,47 +598,8 @@ int main(int argc, char** argv) {
             }
         }
 
-        if ( mode == Mode::StreamEnc || mode == Mode::BlockEnc ) {
-            // ======== HMAC Creation ========
-            // 1. Open the encrypted file to read header and ciphertext
-            std::ifstream fin_enc(encFile, std::ios::binary);
-            if (!fin_enc.is_open()) {
-                throw std::runtime_error("Cannot reopen encrypted file for HMAC computation: " + encFile);
-            }
-
-            // 2. Read the header
-            FileHeader hdr_enc = readFileHeader(fin_enc);
-
-            // 3. Read the ciphertext (rest of the file after header)
-            std::vector<uint8_t> ciphertext_enc(
-                (std::istreambuf_iterator<char>(fin_enc)),
-                (std::istreambuf_iterator<char>())
-            );
-            fin_enc.close();
-
-            // 4. Serialize the header with zeroed HMAC for HMAC computation
-            FileHeader hdr_enc_for_hmac = hdr_enc;
-            std::fill(hdr_enc_for_hmac.hmac.begin(), hdr_enc_for_hmac.hmac.end(), 0x00);
-            std::vector<uint8_t> headerData_enc = serializeFileHeader(hdr_enc_for_hmac);
-
-            // 6. Compute HMAC
-            auto hmac_enc = createHMAC(headerData_enc, ciphertext_enc, keyVec_enc);
-
-            // 7. Update the HMAC field in the original header
-            hdr_enc.hmac = std::array<uint8_t, 32>();
-            std::copy(hmac_enc.begin(), hmac_enc.end(), hdr_enc.hmac.begin());
-
-            // 8. Overwrite only the HMAC field in the encrypted file
-            std::ofstream fout_enc(encFile, std::ios::binary | std::ios::in | std::ios::out);
-            if (!fout_enc.is_open()) {
-                throw std::runtime_error("Cannot reopen encrypted file for HMAC writing: " + encFile);
-            }
-
-            // Use the new function to write HMAC
-            writeHMACToStream(fout_enc, hdr_enc.hmac);
-            fout_enc.close();
-
-            // Test read back
+        if ( mode == Mode::BlockEnc && !piped ) {
+            // Test read back (stream-enc files carry their tag after the end frame instead)
             std::ifstream test_enc(encFile, std::ios::binary);
             auto test_hdr = readFileHeader(test_enc);
             test_enc.close();
@@ -0,0 +1,106 @@
+#pragma once
+// Scatter matching: place every byte of a block at a distinct position of a trial's output
+// that holds that byte, as the series, scatter, mapscatter and parascatter searches need.
+//
+// A block stays fixed while many trials are tried against it, so its byte positions are
+// counting-sorted by value once (setBlock). A trial then walks its output once and hands each
+// position to the next unplaced block byte with that value, so byte k gets the r-th occurrence
+// of its value, r counting the earlier block bytes with the same value. The index is sized to
+// the block (a few hundred bytes, L1 resident) and a trial only rewinds the counters of the
+// values the block contains; nothing is cleared per trial.
+
+class ScatterMatcher {
+public:
+  explicit ScatterMatcher(size_t maxBlockLen) : byValue(maxBlockLen) {
+    values.reserve(std::min<size_t>(maxBlockLen, 256));
+  }
+
+  void setBlock(const uint8_t* data, size_t len) {
+    block = data;
+    blockLen = len;
+    uint16_t count[256] = { 0 };
+    for (size_t i = 0; i < len; i++) {
+      count[data[i]]++;
+    }
+    values.clear();
+    uint16_t start = 0;
+    for (size_t v = 0; v < 256; v++) {
+      valueStart[v] = start;
+      valueTaken[v] = start;
+      start += count[v];
+      valueEnd[v] = start;
+      if (count[v] > 0) {
+        values.push_back(static_cast<uint8_t>(v));
+      }
+    }
+    for (size_t i = 0; i < len; i++) {
+      byValue[valueTaken[data[i]]++] = static_cast<uint16_t>(i);
+    }
+  }
+
+  // Scatter and parascatter: occurrences counted from the start. The output is extended only
+  // as far as the walk gets, which ends once every byte is placed or once fewer positions are
+  // left than bytes still unplaced.
+  bool matchForward(TrialOutput& output, uint16_t* indices) {
+    rewind();
+    const uint8_t* out = output.data();
+    const size_t outLen = output.size();
+    size_t unplaced = blockLen;
+    for (size_t pos = 0; unplaced > 0 && unplaced <= outLen - pos; pos++) {
+      if (pos == output.ready()) {
+        output.reach(pos + 1);
+      }
+      unplaced -= place(out[pos], pos, indices);
+    }
+    return unplaced == 0;
+  }
+
+  // Mapscatter: occurrences counted from the end, so the last occurrence of a value goes to
+  // its first block byte. Needs the whole output.
+  bool matchBackward(const uint8_t* out, size_t outLen, uint16_t* indices) {
+    rewind();
+    size_t unplaced = blockLen;
+    for (size_t pos = outLen; unplaced > 0 && unplaced <= pos; pos--) {
+      unplaced -= place(out[pos - 1], pos - 1, indices);
+    }
+    return unplaced == 0;
+  }
+
+  // Series: each byte at the first occurrence after the previous byte's position
+  bool matchSeries(TrialOutput& output, uint16_t* indices) const {
+    const uint8_t* out = output.data();
+    const size_t outLen = output.size();
+    size_t byteIdx = 0;
+    for (size_t pos = 0; byteIdx < blockLen && blockLen - byteIdx <= outLen - pos; pos++) {
+      if (pos == output.ready()) {
+        output.reach(pos + 1);
+      }
+      if (out[pos] == block[byteIdx]) {
+        indices[byteIdx++] = static_cast<uint16_t>(pos);
+      }
+    }
+    return byteIdx == blockLen;
+  }
+
+private:
+  void rewind() {
+    for (uint8_t v : values) {
+      valueTaken[v] = valueStart[v];
+    }
+  }
+
+  // Give output position `pos` (holding `v`) to the next unplaced block byte of that value
+  size_t place(uint8_t v, size_t pos, uint16_t* indices) {
+    if (valueTaken[v] == valueEnd[v]) {
+      return 0;
+    }
+    indices[byValue[valueTaken[v]++]] = static_cast<uint16_t>(pos);
+    return 1;
+  }
+
+  const uint8_t* block = nullptr;
+  size_t blockLen = 0;
+  uint16_t valueStart[256], valueEnd[256], valueTaken[256];
+  std::vector<uint8_t> values; // Distinct values in the block
+  std::vector<uint16_t> byValue; // Block positions, grouped by value
+};
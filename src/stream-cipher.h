@@ -2,7 +2,763 @@
 
 #include "file-header.h"
 #include "common.h"
-#include "tool.h" // for compressData, decompressData, derivePRK, extendOutputKDF, etc.
+#include "tool.h" // for compressData, decompressData, derivePRK, Keystream, etc.
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+
+/* ------------------------------------------------------------------
+ *  Chunked stream container (cipherMode 0x12)
+ *
+ *  [FileHeader v0x03] then frames of
+ *      LE32 compressed length || zlib(chunk)
+ *  for plaintext chunks of at most blockSize KiB, ended by a zero-length frame and
+ *  the file tag (in the clear). Everything after the header, lengths included, is
+ *  XORed with one keystream starting at outputExtension. originalSize holds the
+ *  total *uncompressed* size. Encoder and decoder hold one chunk at a time, whatever
+ *  the file size.
+ *
+ *  A segment tag is createHMAC(header || LE64 chunk number, frame ciphertext, key) and
+ *  the file tag is createHMAC(header || LE64 chunk count, every segment tag in chunk
+ *  order, key), where header is the serialized header with a zero HMAC. The header's
+ *  own HMAC field stays zero: the file tag is known once the last frame is written,
+ *  so the writer never goes back over the file.
+ *
+ *  With STREAM_FLAG_INDEX the file tag is followed by a segment index:
+ *      entries: per chunk, LE64 frame offset (from the first frame) || segment tag,
+ *               XORed with the keystream that continues after the end frame
+ *      trailer: index tag || LE64 entry count || "RCRYIDX1"
+ *  The index tag is createHMAC(header || LE64 count, encrypted entries, key). Since
+ *  every chunk holds exactly blockSize KiB of plaintext (but the last), a byte range
+ *  can be decrypted and authenticated from the header, the index and only the chunks
+ *  it covers.
+ *
+ *  With STREAM_FLAG_CHUNK_TAGS (input of unknown size, e.g. a pipe) every frame,
+ *  the end frame included, is followed by its segment tag in the clear and there is
+ *  no file tag or index. originalSize is 0, and the decoder hands out each chunk only
+ *  once its tag checks. Chunk numbers in the tags rule out
+ *  reordering, and the tagged end frame rules out truncation.
+ * ------------------------------------------------------------------ */
+static constexpr uint8_t STREAM_CHUNKED_MODE = 0x12;
+static constexpr uint16_t STREAM_CHUNK_KIB = 1024;
+static constexpr uint8_t STREAM_FLAG_INDEX = 0x01;
+static constexpr uint8_t STREAM_FLAG_CHUNK_TAGS = 0x02;
+static constexpr uint64_t STREAM_UNKNOWN_SIZE = UINT64_MAX; // streamEncryptChunked: write chunk tags
+static constexpr char STREAM_INDEX_MAGIC[8] = { 'R', 'C', 'R', 'Y', 'I', 'D', 'X', '1' };
+static constexpr size_t STREAM_INDEX_ENTRY = 8 + HMAC_SIZE;
+static constexpr size_t STREAM_INDEX_TRAILER = HMAC_SIZE + 8 + sizeof(STREAM_INDEX_MAGIC);
+
+static uint64_t getStreamLE64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= static_cast<uint64_t>(p[i]) << (i * 8);
+  }
+  return value;
+}
+
+// Tag of one encrypted frame, bound to its chunk number and the file header
+static std::vector<uint8_t> streamSegmentTag(
+  const std::vector<uint8_t> &headerData,
+  uint64_t chunk,
+  const uint8_t *frame,
+  size_t frameLen,
+  const std::vector<uint8_t> &key
+) {
+  std::vector<uint8_t> number;
+  putLE64(number, chunk);
+  HmacContext mac(key, headerData.size() + number.size() + frameLen);
+  mac.update(headerData);
+  mac.update(number);
+  mac.update(frame, frameLen);
+  return mac.final();
+}
+
+// Whole-file tag of an untagged chunked stream over the segment tags, in chunk order
+static std::vector<uint8_t> streamFileTag(
+  const std::vector<uint8_t> &headerData,
+  const std::vector<std::vector<uint8_t>> &tags,
+  const std::vector<uint8_t> &key
+) {
+  std::vector<uint8_t> count;
+  putLE64(count, tags.size());
+  HmacContext mac(key, headerData.size() + count.size() + tags.size() * HMAC_SIZE);
+  mac.update(headerData);
+  mac.update(count);
+  for (const std::vector<uint8_t> &tag : tags) {
+    mac.update(tag);
+  }
+  return mac.final();
+}
+
+// Index entries collected while writing: frame offsets and segment tags in chunk order
+struct StreamSegmentIndex {
+  std::vector<uint64_t> offsets;
+  std::vector<std::vector<uint8_t>> tags;
+};
+
+// The stream keystream for a header's hash, IV, salt and profile
+static Keystream streamKeystream(const FileHeader &hdr, const std::vector<uint8_t> &key, bool verbose) {
+  HashAlgorithm algot = HashAlgorithm::Unknown;
+  if (hdr.hashName == "rainbow") {
+    algot = HashAlgorithm::Rainbow;
+  } else if (hdr.hashName == "rainstorm") {
+    algot = HashAlgorithm::Rainstorm;
+  } else {
+    throw std::runtime_error("[StreamKey] Unsupported hashName: " + hdr.hashName);
+  }
+
+  std::vector<uint8_t> seed_vec(8);
+  for (size_t i = 0; i < 8; ++i) {
+    seed_vec[i] = static_cast<uint8_t>((hdr.iv >> (i * 8)) & 0xFF);
+  }
+  const HashEngine engine = HashEngine::resolve<bswap>(algot, hdr.hashSizeBits);
+  std::vector<uint8_t> prk = derivePRK(seed_vec, hdr.salt, key, engine, verbose);
+  Keystream keystream(prk, engine, static_cast<KeystreamProfile>(hdr.keystreamProfile));
+  keystream.seek(hdr.outputExtension);
+  return keystream;
+}
+
+// One plaintext chunk as an (unencrypted) frame: LE32 compressed length || zlib(chunk)
+static std::vector<uint8_t> chunkFrame(const std::vector<uint8_t> &chunk) {
+  std::vector<uint8_t> compressed = compressData(chunk);
+  std::vector<uint8_t> frame;
+  frame.reserve(4 + compressed.size());
+  for (int i = 0; i < 4; ++i) {
+    frame.push_back(static_cast<uint8_t>((compressed.size() >> (i * 8)) & 0xFF));
+  }
+  frame.insert(frame.end(), compressed.begin(), compressed.end());
+  return frame;
+}
+
+// Per-stage wall time summed over the threads running it, for verbose output
+struct StreamStageTimes {
+  std::atomic<uint64_t> read{0}, deflate{0}, keystream{0}, write{0};
+
+  template <typename Fn>
+  static void time(std::atomic<uint64_t> &stage, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    stage += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+/**
+ * @brief Frame, compress and encrypt every chunk of `in` to `out` on `threads` threads.
+ *
+ * The reader (this thread) hands numbered chunks to workers through a bounded queue.
+ * Each worker deflates its chunk, then takes the next keystream offset in chunk order
+ * (it waits for the previous chunk's frame size), XORs with its own seeked Keystream and
+ * hands the frame (and its segment tag, when indexing or tagging) to the writer thread,
+ * which reassembles frames in order, writes inline tags and records the index entries. At most
+ * 2 * threads chunks are in flight, so memory stays bounded. Returns the keystream
+ * offset after the last frame.
+ */
+static uint64_t streamEncryptFramesPipelined(
+  std::istream &in,
+  std::ostream &out,
+  const Keystream &keystream,
+  unsigned threads,
+  uint64_t &total,
+  uint64_t &frames,
+  StreamStageTimes &times,
+  const std::vector<uint8_t> &headerData,
+  const std::vector<uint8_t> &key,
+  StreamSegmentIndex *index,
+  bool chunkTags
+) {
+  const size_t chunkSize = static_cast<size_t>(STREAM_CHUNK_KIB) * 1024;
+  const size_t maxInFlight = static_cast<size_t>(threads) * 2;
+
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<std::pair<uint64_t, std::vector<uint8_t>>> todo;
+  std::map<uint64_t, std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> ready; // frame, tag
+  uint64_t chunksRead = 0;
+  bool readDone = false;
+  uint64_t offsetSeq = 0;                 // Chunk whose keystream offset is next
+  uint64_t nextOffset = keystream.tell(); // ...and that offset
+  uint64_t nextWrite = 0;
+  size_t inFlight = 0;
+  std::exception_ptr error;
+
+  auto fail = [&](std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(m);
+    if (!error) error = e;
+    cv.notify_all();
+  };
+
+  auto worker = [&]() {
+    Keystream ks = keystream;
+    ks.setParallel(false);
+    while (true) {
+      std::pair<uint64_t, std::vector<uint8_t>> job;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return !todo.empty() || readDone || error; });
+        if (error || todo.empty()) return;
+        job = std::move(todo.front());
+        todo.pop_front();
+      }
+      try {
+        std::vector<uint8_t> frame;
+        StreamStageTimes::time(times.deflate, [&] { frame = chunkFrame(job.second); });
+
+        uint64_t offset;
+        {
+          std::unique_lock<std::mutex> lock(m);
+          cv.wait(lock, [&] { return offsetSeq == job.first || error; });
+          if (error) return;
+          offset = nextOffset;
+          nextOffset += frame.size();
+          ++offsetSeq;
+          cv.notify_all();
+        }
+
+        StreamStageTimes::time(times.keystream, [&] {
+          ks.seek(offset);
+          ks.xorInto(frame.data(), frame.size());
+        });
+        std::vector<uint8_t> tag;
+        if (index || chunkTags) {
+          tag = streamSegmentTag(headerData, job.first, frame.data(), frame.size(), key);
+        }
+
+        std::lock_guard<std::mutex> lock(m);
+        ready.emplace(job.first, std::make_pair(std::move(frame), std::move(tag)));
+        cv.notify_all();
+      } catch (...) {
+        fail(std::current_exception());
+        return;
+      }
+    }
+  };
+
+  auto writer = [&]() {
+    uint64_t position = 0;
+    while (true) {
+      std::vector<uint8_t> frame, tag;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return ready.count(nextWrite) || (readDone && nextWrite == chunksRead) || error; });
+        if (error || !ready.count(nextWrite)) return;
+        auto it = ready.find(nextWrite);
+        frame = std::move(it->second.first);
+        tag = std::move(it->second.second);
+        ready.erase(it);
+      }
+      try {
+        StreamStageTimes::time(times.write, [&] {
+          out.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+          if (chunkTags) {
+            out.write(reinterpret_cast<const char*>(tag.data()), tag.size());
+          }
+        });
+        if (!out.good()) {
+          throw std::runtime_error("[StreamEnc] Failed to write chunk");
+        }
+        if (index) {
+          index->offsets.push_back(position);
+          index->tags.push_back(std::move(tag));
+        }
+        position += frame.size();
+      } catch (...) {
+        fail(std::current_exception());
+        return;
+      }
+      std::lock_guard<std::mutex> lock(m);
+      ++nextWrite;
+      --inFlight;
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads; ++t) {
+    pool.emplace_back(worker);
+  }
+  std::thread writeThread(writer);
+
+  try {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return inFlight < maxInFlight || error; });
+        if (error) break;
+      }
+      std::vector<uint8_t> chunk(chunkSize);
+      size_t got = 0;
+      StreamStageTimes::time(times.read, [&] {
+        in.read(reinterpret_cast<char*>(chunk.data()), chunkSize);
+        got = static_cast<size_t>(in.gcount());
+      });
+      if (got == 0) break;
+      chunk.resize(got);
+      total += got;
+
+      std::lock_guard<std::mutex> lock(m);
+      todo.emplace_back(chunksRead++, std::move(chunk));
+      ++inFlight;
+      cv.notify_all();
+      if (got < chunkSize) break;
+    }
+  } catch (...) {
+    fail(std::current_exception());
+  }
+  {
+    std::lock_guard<std::mutex> lock(m);
+    readDone = true;
+    cv.notify_all();
+  }
+
+  for (auto &t : pool) {
+    t.join();
+  }
+  writeThread.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  frames = chunksRead;
+  return nextOffset;
+}
+
+/**
+ * @brief Encrypt `inputSize` bytes from `in` into the chunked container on `out`.
+ *        The size goes into the header, which is written first; the input must
+ *        deliver exactly that many bytes. STREAM_UNKNOWN_SIZE instead encrypts
+ *        whatever `in` holds with per-chunk tags (no index), for pipes. With
+ *        threads > 1 the chunks run through streamEncryptFramesPipelined; the output
+ *        is the same either way. The file tag is computed from the segment tags as they
+ *        are written; segmentIndex appends the index that `dec --range` reads.
+ */
+static void streamEncryptChunked(
+  std::istream &in,
+  uint64_t inputSize,
+  std::ostream &out,
+  const std::vector<uint8_t> &key,
+  HashAlgorithm algot,
+  uint32_t hash_bits,
+  uint64_t seed,
+  const std::vector<uint8_t> &salt,
+  uint32_t outputExtension,
+  bool verbose,
+  KeystreamProfile profile = KeystreamProfile::Kdf,
+  unsigned threads = 1,
+  bool segmentIndex = true
+) {
+  auto started = std::chrono::steady_clock::now();
+  const bool chunkTags = inputSize == STREAM_UNKNOWN_SIZE;
+  if (chunkTags) {
+    segmentIndex = false; // Offsets would have to account for the inline tags
+  }
+
+  FileHeader hdr{};
+  hdr.magic           = MagicNumber;
+  hdr.version         = FILE_HEADER_EXT_VERSION;
+  hdr.cipherMode      = STREAM_CHUNKED_MODE;
+  hdr.blockSize       = STREAM_CHUNK_KIB;  // Plaintext chunk size in KiB
+  hdr.nonceSize       = 0;                 // Not used in stream cipher
+  hdr.outputExtension = outputExtension;
+  hdr.hashSizeBits    = hash_bits;
+  hdr.hashName        = (algot == HashAlgorithm::Rainbow) ? "rainbow" : "rainstorm";
+  hdr.iv              = seed;              // seed as IV
+  hdr.saltLen         = static_cast<uint8_t>(salt.size());
+  hdr.salt            = salt;
+  hdr.searchModeEnum  = 0xFF;              // Stream
+  hdr.originalSize    = chunkTags ? 0 : inputSize;
+  hdr.keystreamProfile = static_cast<uint8_t>(profile);
+  hdr.streamFlags     = chunkTags ? STREAM_FLAG_CHUNK_TAGS : segmentIndex ? STREAM_FLAG_INDEX : 0x00;
+  writeFileHeader(out, hdr);
+  const std::vector<uint8_t> headerData = serializeFileHeader(hdr); // HMAC still zero
+
+  Keystream keystream = streamKeystream(hdr, key, verbose);
+
+  uint64_t total = 0;
+  uint64_t frames = 0;
+  StreamStageTimes times;
+  StreamSegmentIndex index;
+  StreamSegmentIndex *indexOut = chunkTags ? nullptr : &index; // Tags feed the file tag
+  if (threads > 1) {
+    keystream.seek(streamEncryptFramesPipelined(in, out, keystream, threads, total, frames, times,
+                                                headerData, key, indexOut, chunkTags));
+  } else {
+    uint64_t position = 0;
+    const size_t chunkSize = static_cast<size_t>(STREAM_CHUNK_KIB) * 1024;
+    std::vector<uint8_t> chunk(chunkSize);
+    while (true) {
+      size_t got = 0;
+      StreamStageTimes::time(times.read, [&] {
+        in.read(reinterpret_cast<char*>(chunk.data()), chunkSize);
+        got = static_cast<size_t>(in.gcount());
+      });
+      if (got == 0) break;
+      chunk.resize(got);
+      total += got;
+
+      std::vector<uint8_t> frame;
+      StreamStageTimes::time(times.deflate, [&] { frame = chunkFrame(chunk); });
+      StreamStageTimes::time(times.keystream, [&] { keystream.xorInto(frame.data(), frame.size()); });
+      std::vector<uint8_t> tag;
+      if (indexOut || chunkTags) {
+        tag = streamSegmentTag(headerData, frames, frame.data(), frame.size(), key);
+      }
+      if (indexOut) {
+        indexOut->offsets.push_back(position);
+        indexOut->tags.push_back(tag);
+      }
+      StreamStageTimes::time(times.write, [&] {
+        out.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+        if (chunkTags) {
+          out.write(reinterpret_cast<const char*>(tag.data()), tag.size());
+        }
+      });
+      if (!out.good()) {
+        throw std::runtime_error("[StreamEnc] Failed to write chunk");
+      }
+      position += frame.size();
+      ++frames;
+
+      chunk.resize(chunkSize);
+      if (got < chunkSize) break;
+    }
+  }
+
+  // Zero-length frame ends the stream
+  uint8_t endFrame[4] = { 0, 0, 0, 0 };
+  keystream.xorInto(endFrame, sizeof(endFrame));
+  out.write(reinterpret_cast<const char*>(endFrame), sizeof(endFrame));
+  if (chunkTags) {
+    std::vector<uint8_t> tag = streamSegmentTag(headerData, frames, endFrame, sizeof(endFrame), key);
+    out.write(reinterpret_cast<const char*>(tag.data()), tag.size());
+  } else {
+    std::vector<uint8_t> fileTag = streamFileTag(headerData, index.tags, key);
+    out.write(reinterpret_cast<const char*>(fileTag.data()), fileTag.size());
+  }
+  out.flush();
+  if (!out.good()) {
+    throw std::runtime_error("[StreamEnc] Failed to write end frame");
+  }
+
+  // Segment index: encrypted entries, then the trailer in the clear
+  if (segmentIndex) {
+    std::vector<uint8_t> entries;
+    entries.reserve(index.offsets.size() * STREAM_INDEX_ENTRY);
+    for (size_t i = 0; i < index.offsets.size(); ++i) {
+      putLE64(entries, index.offsets[i]);
+      entries.insert(entries.end(), index.tags[i].begin(), index.tags[i].end());
+    }
+    keystream.xorInto(entries.data(), entries.size());
+
+    std::vector<uint8_t> countPrefix(headerData);
+    putLE64(countPrefix, index.offsets.size());
+    std::vector<uint8_t> trailer = createHMAC(countPrefix, entries, key);
+    putLE64(trailer, index.offsets.size());
+    trailer.insert(trailer.end(), STREAM_INDEX_MAGIC, STREAM_INDEX_MAGIC + sizeof(STREAM_INDEX_MAGIC));
+
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size());
+    out.write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+    if (!out.good()) {
+      throw std::runtime_error("[StreamEnc] Failed to write segment index");
+    }
+  }
+
+  if (!chunkTags && total != inputSize) {
+    throw std::runtime_error("[StreamEnc] Input size changed while encrypting (expected "
+                             + std::to_string(inputSize) + " bytes, read " + std::to_string(total) + ")");
+  }
+  if (verbose) {
+    auto ms = [](uint64_t ns) { return std::to_string(ns / 1000000) + " ms"; };
+    const uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - started).count();
+    std::cerr << "[StreamEnc] " << total << " bytes in " << frames << " chunks of up to "
+              << STREAM_CHUNK_KIB << " KiB on " << std::max(threads, 1u) << " thread(s)\n";
+    std::cerr << "[StreamEnc] Stage time (summed over threads): read " << ms(times.read)
+              << ", deflate " << ms(times.deflate) << ", keystream+xor " << ms(times.keystream)
+              << ", write " << ms(times.write) << "; wall " << ms(wall) << "\n";
+  }
+}
+
+/**
+ * @brief Decrypt the frames following an already-read chunked header from `in` to `out`.
+ *        With chunk tags each chunk is authenticated before it is written; otherwise the
+ *        file tag after the end frame is checked last, so callers stage `out` and keep
+ *        it only if this returns.
+ */
+static void streamDecryptChunked(
+  std::istream &in,
+  const FileHeader &hdr,
+  std::ostream &out,
+  const std::vector<uint8_t> &key,
+  bool verbose
+) {
+  if (hdr.cipherMode != STREAM_CHUNKED_MODE) {
+    throw std::runtime_error("[StreamDec] Not a chunked stream cipher file");
+  }
+  if (hdr.blockSize == 0) {
+    throw std::runtime_error("[StreamDec] Invalid chunk size in header");
+  }
+
+  Keystream keystream = streamKeystream(hdr, key, verbose);
+  const bool chunkTags = (hdr.streamFlags & STREAM_FLAG_CHUNK_TAGS) != 0;
+  const std::vector<uint8_t> headerData = serializeFileHeaderForHMAC(hdr);
+  std::vector<std::vector<uint8_t>> tags; // Segment tags for the file tag (untagged streams)
+
+  auto readIn = [&](uint8_t *p, size_t len) {
+    in.read(reinterpret_cast<char*>(p), static_cast<std::streamsize>(len));
+    return static_cast<size_t>(in.gcount());
+  };
+  const std::string corrupt = "(wrong key or tampered file)";
+
+  // Check the tag following frame number `chunk` (still encrypted, length included)
+  auto checkTag = [&](uint64_t chunk, const std::vector<uint8_t> &encrypted) {
+    std::vector<uint8_t> tag(HMAC_SIZE);
+    if (readIn(tag.data(), tag.size()) != tag.size()) {
+      throw std::runtime_error("[StreamDec] Truncated ciphertext (missing chunk tag)");
+    }
+    if (!hmacEqual(streamSegmentTag(headerData, chunk, encrypted.data(), encrypted.size(), key), tag)) {
+      throw std::runtime_error("[StreamDec] Chunk " + std::to_string(chunk)
+                               + " failed authentication (wrong key or tampered stream)");
+    }
+  };
+
+  // A frame can never be larger than zlib's bound for one full chunk
+  const size_t chunkSize = static_cast<size_t>(hdr.blockSize) * 1024;
+  const size_t maxFrame = compressBound(static_cast<uLong>(chunkSize));
+  std::vector<uint8_t> frame; // LE32 length || body, as read
+  std::vector<uint8_t> plain(chunkSize);
+  uint64_t total = 0;
+  uint64_t chunks = 0;
+  while (true) {
+    frame.resize(4);
+    if (readIn(frame.data(), 4) != 4) {
+      throw std::runtime_error("[StreamDec] Truncated ciphertext (missing end frame)");
+    }
+    uint8_t lenBytes[4];
+    std::memcpy(lenBytes, frame.data(), 4);
+    keystream.xorInto(lenBytes, sizeof(lenBytes));
+    size_t frameLen = 0;
+    for (int i = 0; i < 4; ++i) {
+      frameLen |= static_cast<size_t>(lenBytes[i]) << (i * 8);
+    }
+    if (frameLen == 0) {
+      if (chunkTags) {
+        checkTag(chunks, frame);
+      } else {
+        std::vector<uint8_t> fileTag(HMAC_SIZE);
+        if (readIn(fileTag.data(), fileTag.size()) != fileTag.size()) {
+          throw std::runtime_error("[StreamDec] Truncated ciphertext (missing file tag)");
+        }
+        if (!hmacEqual(streamFileTag(headerData, tags, key), fileTag)) {
+          throw std::runtime_error("[StreamDec] File tag verification failed " + corrupt);
+        }
+      }
+      break;
+    }
+    if (frameLen > maxFrame) {
+      if (chunkTags) {
+        throw std::runtime_error("[StreamDec] Chunk " + std::to_string(chunks)
+                                 + " failed authentication (wrong key or tampered stream)");
+      }
+      throw std::runtime_error("[StreamDec] Corrupt length for chunk " + std::to_string(chunks) + " " + corrupt);
+    }
+
+    frame.resize(4 + frameLen);
+    if (readIn(frame.data() + 4, frameLen) != frameLen) {
+      throw std::runtime_error("[StreamDec] Truncated chunk");
+    }
+    if (chunkTags) {
+      checkTag(chunks, frame);
+    } else {
+      tags.push_back(streamSegmentTag(headerData, chunks, frame.data(), frame.size(), key));
+    }
+    keystream.xorInto(frame.data() + 4, frameLen);
+
+    // Without chunk tags the frame is not authenticated yet: never inflate past one chunk
+    size_t plainLen = 0;
+    try {
+      plainLen = decompressInto(frame.data() + 4, frameLen, plain.data(), plain.size());
+    } catch (const std::exception &) {
+      throw std::runtime_error("[StreamDec] Chunk " + std::to_string(chunks)
+                               + " does not decompress within the header's chunk size " + corrupt);
+    }
+    out.write(reinterpret_cast<const char*>(plain.data()), plainLen);
+    if (!out.good()) {
+      throw std::runtime_error("[StreamDec] Failed to write plaintext");
+    }
+    total += plainLen;
+    ++chunks;
+  }
+  // Only a segment index may follow; nothing else is authenticated
+  if (!(hdr.streamFlags & STREAM_FLAG_INDEX) && in.peek() != std::char_traits<char>::eof()) {
+    throw std::runtime_error("[StreamDec] Unexpected data after the end of the stream");
+  }
+  out.flush();
+
+  if (!chunkTags && total != hdr.originalSize) {
+    throw std::runtime_error("[StreamDec] Decrypted size " + std::to_string(total)
+                             + " does not match header size " + std::to_string(hdr.originalSize));
+  }
+  if (verbose) {
+    std::cerr << "[StreamDec] Decrypted " << total << " bytes\n";
+  }
+}
+
+// Parse "A-B" (inclusive byte offsets) or "A-" (to the end of the plaintext)
+static void parseByteRange(const std::string &spec, uint64_t &first, uint64_t &last) {
+  const size_t dash = spec.find('-');
+  if (dash == std::string::npos || dash == 0) {
+    throw std::runtime_error("Invalid --range: " + spec + " (expected A-B or A-)");
+  }
+  try {
+    first = std::stoull(spec.substr(0, dash));
+    last = dash + 1 < spec.size() ? std::stoull(spec.substr(dash + 1)) : UINT64_MAX;
+  } catch (const std::exception &) {
+    throw std::runtime_error("Invalid --range: " + spec + " (expected A-B or A-)");
+  }
+  if (last < first) {
+    throw std::runtime_error("Invalid --range: " + spec + " (end before start)");
+  }
+}
+
+/**
+ * @brief Decrypt plaintext bytes first..last (inclusive, clamped to the file) of an
+ *        indexed chunked stream file to `out`, reading only the header, the index and
+ *        the chunks that overlap the range. The index and each chunk read are
+ *        authenticated by their tags instead of the whole-file HMAC. Chunks are written
+ *        as each one verifies, so callers stage `out` and keep it only on success.
+ * @return Number of plaintext bytes written
+ */
+static uint64_t streamDecryptRange(
+  const std::string &inFilename,
+  uint64_t first,
+  uint64_t last,
+  std::ostream &out,
+  const std::vector<uint8_t> &key,
+  bool verbose
+) {
+  std::ifstream fin(inFilename, std::ios::binary);
+  if (!fin.is_open()) {
+    throw std::runtime_error("[StreamRange] Cannot open input file: " + inFilename);
+  }
+  FileHeader hdr = readFileHeader(fin);
+  if (hdr.cipherMode != STREAM_CHUNKED_MODE || !(hdr.streamFlags & STREAM_FLAG_INDEX)) {
+    throw std::runtime_error("[StreamRange] --range needs a chunked stream file with a segment index");
+  }
+  if (hdr.blockSize == 0) {
+    throw std::runtime_error("[StreamRange] Invalid chunk size in header");
+  }
+  const uint64_t headerSize = static_cast<uint64_t>(fin.tellg());
+  const uint64_t fileSize = getFileSize(inFilename);
+  FileHeader zeroed = hdr;
+  std::fill(zeroed.hmac.begin(), zeroed.hmac.end(), 0x00);
+  const std::vector<uint8_t> headerData = serializeFileHeader(zeroed);
+
+  // Trailer, then the index it describes
+  if (fileSize < headerSize + 4 + HMAC_SIZE + STREAM_INDEX_TRAILER) {
+    throw std::runtime_error("[StreamRange] File too small to hold a segment index");
+  }
+  uint8_t trailer[STREAM_INDEX_TRAILER];
+  fin.seekg(static_cast<std::streamoff>(fileSize - STREAM_INDEX_TRAILER));
+  fin.read(reinterpret_cast<char*>(trailer), sizeof(trailer));
+  if (!fin.good() || std::memcmp(trailer + HMAC_SIZE + 8, STREAM_INDEX_MAGIC, sizeof(STREAM_INDEX_MAGIC)) != 0) {
+    throw std::runtime_error("[StreamRange] Segment index trailer not found");
+  }
+  const uint64_t count = getStreamLE64(trailer + HMAC_SIZE);
+  const uint64_t room = fileSize - STREAM_INDEX_TRAILER - headerSize - 4 - HMAC_SIZE;
+  if (count > room / STREAM_INDEX_ENTRY) {
+    throw std::runtime_error("[StreamRange] Corrupt segment index count");
+  }
+  const uint64_t indexPos = fileSize - STREAM_INDEX_TRAILER - count * STREAM_INDEX_ENTRY;
+  std::vector<uint8_t> entries(count * STREAM_INDEX_ENTRY);
+  fin.seekg(static_cast<std::streamoff>(indexPos));
+  fin.read(reinterpret_cast<char*>(entries.data()), entries.size());
+  if (!fin.good()) {
+    throw std::runtime_error("[StreamRange] Failed to read segment index");
+  }
+
+  std::vector<uint8_t> countPrefix(headerData);
+  putLE64(countPrefix, count);
+  if (!hmacEqual(createHMAC(countPrefix, entries, key),
+                 std::vector<uint8_t>(trailer, trailer + HMAC_SIZE))) {
+    throw std::runtime_error("[StreamRange] Segment index authentication failed (wrong key or tampered file)");
+  }
+
+  Keystream keystream = streamKeystream(hdr, key, verbose);
+  keystream.seek(hdr.outputExtension + (indexPos - headerSize - HMAC_SIZE)); // The file tag is in the clear
+  keystream.xorInto(entries.data(), entries.size());
+
+  const uint64_t chunkSize = static_cast<uint64_t>(hdr.blockSize) * 1024;
+  const uint64_t plainSize = hdr.originalSize;
+  if (plainSize == 0 || first >= plainSize) {
+    throw std::runtime_error("[StreamRange] Range starts past the end of the plaintext ("
+                             + std::to_string(plainSize) + " bytes)");
+  }
+  last = std::min(last, plainSize - 1);
+  if (count != (plainSize + chunkSize - 1) / chunkSize) {
+    throw std::runtime_error("[StreamRange] Segment index does not match the plaintext size");
+  }
+
+  // Frames end where the next one starts; the last one ends at the end frame and file tag
+  auto frameOffset = [&](uint64_t i) { return getStreamLE64(entries.data() + i * STREAM_INDEX_ENTRY); };
+  const uint64_t framesEnd = indexPos - headerSize - 4 - HMAC_SIZE;
+  const size_t maxFrame = compressBound(static_cast<uLong>(chunkSize)) + 4;
+
+  uint64_t written = 0;
+  std::vector<uint8_t> frame;
+  std::vector<uint8_t> plain(chunkSize);
+  for (uint64_t i = first / chunkSize; i <= last / chunkSize; ++i) {
+    const uint64_t begin = frameOffset(i);
+    const uint64_t end = i + 1 < count ? frameOffset(i + 1) : framesEnd;
+    if (end <= begin + 4 || end - begin > maxFrame || end > framesEnd) {
+      throw std::runtime_error("[StreamRange] Corrupt segment index entry " + std::to_string(i));
+    }
+    frame.resize(end - begin);
+    fin.seekg(static_cast<std::streamoff>(headerSize + begin));
+    fin.read(reinterpret_cast<char*>(frame.data()), frame.size());
+    if (!fin.good()) {
+      throw std::runtime_error("[StreamRange] Truncated chunk " + std::to_string(i));
+    }
+
+    const uint8_t *tag = entries.data() + i * STREAM_INDEX_ENTRY + 8;
+    if (!hmacEqual(streamSegmentTag(headerData, i, frame.data(), frame.size(), key),
+                   std::vector<uint8_t>(tag, tag + HMAC_SIZE))) {
+      throw std::runtime_error("[StreamRange] Chunk " + std::to_string(i) + " failed authentication");
+    }
+
+    keystream.seek(hdr.outputExtension + begin);
+    keystream.xorInto(frame.data(), frame.size());
+    const uint64_t frameLen = static_cast<uint64_t>(frame[0]) | (static_cast<uint64_t>(frame[1]) << 8)
+                            | (static_cast<uint64_t>(frame[2]) << 16) | (static_cast<uint64_t>(frame[3]) << 24);
+    if (frameLen != frame.size() - 4) {
+      throw std::runtime_error("[StreamRange] Chunk " + std::to_string(i) + " length mismatch");
+    }
+    const uint64_t chunkStart = i * chunkSize;
+    size_t plainLen = 0;
+    try {
+      plainLen = decompressInto(frame.data() + 4, frame.size() - 4, plain.data(), plain.size());
+    } catch (const std::exception &) {
+      throw std::runtime_error("[StreamRange] Chunk " + std::to_string(i) + " failed to decompress");
+    }
+    if (plainLen != std::min(chunkSize, plainSize - chunkStart)) {
+      throw std::runtime_error("[StreamRange] Chunk " + std::to_string(i) + " has the wrong size");
+    }
+
+    const uint64_t from = std::max(first, chunkStart) - chunkStart;
+    const uint64_t to = std::min(last, chunkStart + plainLen - 1) - chunkStart;
+    out.write(reinterpret_cast<const char*>(plain.data() + from), to - from + 1);
+    if (!out.good()) {
+      throw std::runtime_error("[StreamRange] Failed to write plaintext");
+    }
+    written += to - from + 1;
+  }
+
+  if (verbose) {
+    std::cerr << "[StreamRange] Bytes " << first << "-" << last << ": read "
+              << (last / chunkSize - first / chunkSize + 1) << " of " << count << " chunks\n";
+  }
+  return written;
+}
 
 /**
  * @brief Buffer-based stream encryption. Produces a buffer containing:
@@ -17,9 +773,13 @@
  * @param salt            Additional salt
  * @param outputExtension Extra bytes of keystream offset
  * @param verbose         Whether to print debugging info
+ * @param profile         Keystream expansion; anything but Kdf writes a v0x03 header
  * @return std::vector<uint8_t>  The final output: [FileHeader bytes][XOR'd bytes]
+ *
+ * Writes the whole-buffer (0x10) format used by the wasm exports; rainsum itself
+ * writes the chunked format.
  */
-static std::vector<uint8_t> streamEncryptBuffer(
+[[maybe_unused]] static std::vector<uint8_t> streamEncryptBuffer(
   const std::vector<uint8_t> &plainData,
   std::vector<uint8_t> &key,
   HashAlgorithm algot,
@@ -27,7 +787,8 @@ static std::vector<uint8_t> streamEncryptBuffer(
   uint64_t seed,
   const std::vector<uint8_t> &salt,
   uint32_t outputExtension,
-  bool verbose
+  bool verbose,
+  KeystreamProfile profile = KeystreamProfile::Kdf
 ) {
   // 2) Compress the plaintext
   auto compressed = compressData(plainData);
@@ -35,7 +796,8 @@ static std::vector<uint8_t> streamEncryptBuffer(
   // 1) Prepare the FileHeader in memory
   FileHeader hdr{};
   hdr.magic          = MagicNumber;
-  hdr.version        = 0x02;        // Example version
+  // Kdf files keep the v0x02 layout so older builds can still read them
+  hdr.version        = profile == KeystreamProfile::Kdf ? 0x02 : FILE_HEADER_EXT_VERSION;
   hdr.cipherMode     = 0x10;        // Stream Cipher
   hdr.blockSize      = 0;           // Not used in stream cipher
   hdr.nonceSize      = 0;           // Not used in stream cipher
@@ -46,6 +808,7 @@ static std::vector<uint8_t> streamEncryptBuffer(
   hdr.saltLen        = static_cast<uint8_t>(salt.size());
   hdr.salt           = salt;
   hdr.originalSize   = compressed.size();
+  hdr.keystreamProfile = static_cast<uint8_t>(profile);
 
   // 2) Serialize header to a buffer
   std::vector<uint8_t> headerBytes = serializeFileHeader(hdr);
@@ -55,18 +818,17 @@ static std::vector<uint8_t> streamEncryptBuffer(
   for (size_t i = 0; i < 8; ++i) {
     seed_vec[i] = static_cast<uint8_t>((seed >> (i * 8)) & 0xFF);
   }
+  const HashEngine engine = HashEngine::resolve<bswap>(algot, hash_bits);
   std::vector<uint8_t> ikm(key.begin(), key.end());
-  std::vector<uint8_t> prk = derivePRK(seed_vec, salt, ikm, algot, hash_bits, verbose);
+  std::vector<uint8_t> prk = derivePRK(seed_vec, salt, ikm, engine, verbose);
 
-  // 4) Generate Keystream
-  size_t needed   = compressed.size() + outputExtension;
-  auto keystream  = extendOutputKDF(prk, needed, algot, hash_bits);
+  // 4) Keystream, generated as it is consumed
+  Keystream keystream(prk, engine, profile);
 
   if (verbose) {
     std::cerr << "\n[BufferEnc] headerBytes.size(): " << headerBytes.size() << "\n";
     std::cerr << "[BufferEnc] plaintext size: " << compressed.size() << "\n";
-    std::cerr << "[BufferEnc] needed (with extension): " << needed << "\n";
-    std::cerr << "[BufferEnc] keystream.size(): " << keystream.size() << "\n";
+    std::cerr << "[BufferEnc] needed (with extension): " << compressed.size() + outputExtension << "\n";
   }
 
   // 5) Allocate final output buffer = [header][ciphertext]
@@ -76,33 +838,29 @@ static std::vector<uint8_t> streamEncryptBuffer(
   // 6) Append header
   output.insert(output.end(), headerBytes.begin(), headerBytes.end());
 
-  // 7) XOR plaintext with keystream (skipping first outputExtension bytes)
-  std::vector<uint8_t> cipherData(compressed);
-  for (size_t i = 0; i < cipherData.size(); ++i) {
-    cipherData[i] ^= keystream[i + outputExtension];
-  }
-
-  // 8) Append the XOR'd data
-  output.insert(output.end(), cipherData.begin(), cipherData.end());
+  // 7) Append plaintext and XOR it in place with keystream (skipping first outputExtension bytes)
+  const size_t cipherStart = output.size();
+  output.insert(output.end(), compressed.begin(), compressed.end());
+  keystream.seek(outputExtension);
+  keystream.xorInto(output.data() + cipherStart, compressed.size());
 
   return output;
 }
 
 static std::vector<uint8_t> streamDecryptBuffer(
-  const std::vector<uint8_t> &input,
+  const uint8_t *input,
+  size_t inputSize,
   std::vector<uint8_t> &key,
   bool verbose
 ) {
   // 1) Confirm we have enough data for at least the size of FileHeader in memory
-  if (input.size() < sizeof(FileHeader)) {
+  if (inputSize < sizeof(FileHeader)) {
     throw std::runtime_error("[BufferDec] Input too small to contain a FileHeader");
   }
 
-  // Create a memory stream from the input buffer
-  std::istringstream memStream(
-    std::string(reinterpret_cast<const char*>(input.data()), input.size()),
-    std::ios::binary
-  );
+  // Read straight out of the input buffer
+  MappedStreamBuf memBuf(input, inputSize);
+  std::istream memStream(&memBuf);
 
   // Debug: Check the stream state
   if (verbose) {
@@ -117,6 +875,12 @@ static std::vector<uint8_t> streamDecryptBuffer(
   if (hdr.magic != MagicNumber) {
     throw std::runtime_error("[BufferDec] Invalid magic number in header");
   }
+  if (hdr.cipherMode == STREAM_CHUNKED_MODE) {
+    std::ostringstream plain(std::ios::binary);
+    streamDecryptChunked(memStream, hdr, plain, key, verbose);
+    const std::string& bytes = plain.str();
+    return std::vector<uint8_t>(bytes.begin(), bytes.end());
+  }
   if (hdr.cipherMode != 0x10) {
     throw std::runtime_error("[BufferDec] Not a stream cipher file");
   }
@@ -129,12 +893,12 @@ static std::vector<uint8_t> streamDecryptBuffer(
 
   // 4) The remainder after the header is the ciphertext
   size_t headerSize = static_cast<size_t>(memStream.tellg());
-  size_t cipherSize = input.size() - headerSize;
+  size_t cipherSize = inputSize - headerSize;
   if (cipherSize == 0) {
     throw std::runtime_error("[BufferDec] No ciphertext data found");
   }
 
-  std::vector<uint8_t> cipherData(input.begin() + headerSize, input.end());
+  std::vector<uint8_t> cipherData(input + headerSize, input + inputSize);
 
   // 3) Derive PRK
   HashAlgorithm algot = HashAlgorithm::Unknown;
@@ -146,27 +910,29 @@ static std::vector<uint8_t> streamDecryptBuffer(
     throw std::runtime_error("[BufferDec] Unsupported hashName: " + hdr.hashName);
   }
 
+  // Validates the profile before any key derivation
+  const int iterations = keystreamIterations(hdr.keystreamProfile);
+
   std::vector<uint8_t> seed_vec(8);
   for (size_t i = 0; i < 8; ++i) {
     seed_vec[i] = static_cast<uint8_t>((hdr.iv >> (i * 8)) & 0xFF);
   }
+  const HashEngine engine = HashEngine::resolve<bswap>(algot, hdr.hashSizeBits);
   std::vector<uint8_t> ikm(key.begin(), key.end());
-  std::vector<uint8_t> prk = derivePRK(seed_vec, hdr.salt, ikm, algot, hdr.hashSizeBits, verbose);
+  std::vector<uint8_t> prk = derivePRK(seed_vec, hdr.salt, ikm, engine, verbose);
 
-  // 4) Generate Keystream
-  size_t needed = cipherData.size() + hdr.outputExtension;
-  auto keystream = extendOutputKDF(prk, needed, algot, hdr.hashSizeBits);
+  // 4) Keystream, generated as it is consumed
+  Keystream keystream(prk, engine, static_cast<KeystreamProfile>(hdr.keystreamProfile));
 
   if (verbose) {
+    std::cerr << "[BufferDec] keystream rounds per block: " << iterations << "\n";
     std::cerr << "[BufferDec] cipherData.size(): " << cipherData.size() << "\n";
-    std::cerr << "[BufferDec] needed with extension: " << needed << "\n";
-    std::cerr << "[BufferDec] keystream.size(): " << keystream.size() << "\n";
+    std::cerr << "[BufferDec] needed with extension: " << cipherData.size() + hdr.outputExtension << "\n";
   }
 
   // 5) XOR cipherData with keystream (skip extension bytes)
-  for (size_t i = 0; i < cipherData.size(); ++i) {
-    cipherData[i] ^= keystream[i + hdr.outputExtension];
-  }
+  keystream.seek(hdr.outputExtension);
+  keystream.xorInto(cipherData.data(), cipherData.size());
 
   // 6) Decompress
   auto decompressed = decompressData(cipherData);
@@ -174,9 +940,18 @@ static std::vector<uint8_t> streamDecryptBuffer(
   return decompressed;
 }
 
+// Vector form, used by the wasm exports
+[[maybe_unused]] static std::vector<uint8_t> streamDecryptBuffer(
+  const std::vector<uint8_t> &input,
+  std::vector<uint8_t> &key,
+  bool verbose
+) {
+  return streamDecryptBuffer(input.data(), input.size(), key, verbose);
+}
+
 /* ------------------------------------------------------------------
- *  The original file-based encryption function
- *  now uses the new buffer-based approach under the hood
+ *  File-based encryption: streams the file through the chunked
+ *  container, so memory stays at one chunk whatever the file size
  * ------------------------------------------------------------------ */
 static void streamEncryptFileWithHeader(
     const std::string &inFilename,
@@ -187,41 +962,29 @@ static void streamEncryptFileWithHeader(
     uint64_t seed, // Used as IV
     const std::vector<uint8_t> &salt,
     uint32_t outputExtension,
-    bool verbose
+    bool verbose,
+    KeystreamProfile profile = KeystreamProfile::Kdf,
+    unsigned threads = 1,
+    bool segmentIndex = true
 ) {
-  // 1) Read input file
-  std::ifstream fin(inFilename, std::ios::binary);
-  if (!fin.is_open()) {
-    throw std::runtime_error("[StreamEnc] Cannot open input file: " + inFilename);
-  }
-  std::vector<uint8_t> plainData((std::istreambuf_iterator<char>(fin)),
-                                 (std::istreambuf_iterator<char>()));
-  fin.close();
-
-  // 3) Ask the new buffer-based function to create [header + XOR data]
-  std::vector<uint8_t> finalBuffer = streamEncryptBuffer(
-    plainData,
-    key,
-    algot,
-    hash_bits,
-    seed,
-    salt,
-    outputExtension,
-    verbose
-  );
-
-  // 4) Write result to output file
-  std::ofstream fout(outFilename, std::ios::binary);
-  if (!fout.is_open()) {
-    throw std::runtime_error("[StreamEnc] Cannot open output file: " + outFilename);
-  }
-  fout.write(reinterpret_cast<const char*>(finalBuffer.data()), finalBuffer.size());
-  fout.close();
+  // Chunks are copied straight out of the page cache
+  const MappedFile input(inFilename);
+  MappedStreamBuf inBuf(input.data(), input.size());
+  std::istream fin(&inBuf);
+  // Frames go out with one write() each
+  FileWriteBuf outBuf(outFilename);
+  std::ostream fout(&outBuf);
+
+  streamEncryptChunked(fin, input.size(), fout, key, algot, hash_bits,
+                       seed, salt, outputExtension, verbose, profile, threads, segmentIndex);
+  outBuf.close();
 }
 
 /* ------------------------------------------------------------------
- *  The original file-based decryption function
- *  also calls the new buffer-based approach
+ *  File-based decryption in one pass over the mapped ciphertext.
+ *  Chunked files are checked by their file tag (or chunk tags) as they
+ *  decrypt; whole-buffer (0x10) files check the header HMAC up front.
+ *  Either way the output is only renamed into place once it verifies
  * ------------------------------------------------------------------ */
 static void streamDecryptFileWithHeader(
     const std::string &inFilename,
@@ -229,25 +992,33 @@ static void streamDecryptFileWithHeader(
     std::vector<uint8_t> &key,
     bool verbose
 ) {
-  // 1) Read the entire input (including header) from file
-  std::ifstream fin(inFilename, std::ios::binary);
-  if (!fin.is_open()) {
-    throw std::runtime_error("[StreamDec] Cannot open input file: " + inFilename);
-  }
-  std::vector<uint8_t> fileData((std::istreambuf_iterator<char>(fin)),
-                                (std::istreambuf_iterator<char>()));
-  fin.close();
+  const MappedFile input(inFilename);
+  MappedStreamBuf inBuf(input.data(), input.size());
+  std::istream fin(&inBuf);
 
-  // 2) Decrypt the buffer-based approach
-  std::vector<uint8_t> plaintext = streamDecryptBuffer(fileData, key, verbose);
+  FileHeader hdr = readFileHeader(fin);
+  StagedOutput staged(outFilename);
+  if (hdr.cipherMode == STREAM_CHUNKED_MODE) {
+    FileWriteBuf outBuf(staged.partPath());
+    std::ostream fout(&outBuf);
+    streamDecryptChunked(fin, hdr, fout, key, verbose);
+    outBuf.close();
+    staged.commit();
+    return;
+  }
 
-  // 3) Write plaintext to output file
-  std::ofstream fout(outFilename, std::ios::binary);
-  if (!fout.is_open()) {
-    throw std::runtime_error("[StreamDec] Cannot open output file: " + outFilename);
+  // Whole-buffer format: check the tag, then decrypt the entire input (including header)
+  const size_t headerLen = static_cast<size_t>(fin.tellg());
+  const std::vector<uint8_t> headerData = serializeFileHeaderForHMAC(hdr);
+  HmacContext mac(key, headerData.size() + (input.size() - headerLen));
+  mac.update(headerData);
+  mac.update(input.data() + headerLen, input.size() - headerLen);
+  if (!hmacEqual(mac.final(), std::vector<uint8_t>(hdr.hmac.begin(), hdr.hmac.end()))) {
+    throw std::runtime_error("[Dec] HMAC verification failed! File may be corrupted or tampered with.");
   }
-  fout.write(reinterpret_cast<const char*>(plaintext.data()), plaintext.size());
-  fout.close();
+  std::vector<uint8_t> plaintext = streamDecryptBuffer(input.data(), input.size(), key, verbose);
+  writeFileBytes(staged.partPath(), plaintext);
+  staged.commit();
 
   if (verbose) {
     std::cerr << "[StreamDec] Decrypted " << plaintext.size()
@@ -255,5 +1026,3 @@ static void streamDecryptFileWithHeader(
               << " to " << outFilename << "\n";
   }
 }
-
-
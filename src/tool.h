@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <stdexcept>
 #include <memory>
+#include <optional>
 #include <thread>
 #include <iterator>
 #include <zlib.h>
@@ -36,6 +37,7 @@ static std::mutex cerr_mutex;
 #include "rainstorm.cpp"
 #include "cxxopts.hpp"
 #include "common.h"
+#include "mapped-file.h"
 
 
 // Magic number to identify your file format ('RCRY' in hex).
@@ -57,6 +59,15 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
     std::string(64, '@')
   };
 
+// Extra tree mode test inputs, sized on and around the leaf boundaries.
+// Byte i of each input is (i * 7 + 3) & 0xFF.
+  std::vector<size_t> tree_test_lengths = {
+    (1 << 20) - 1,
+    (1 << 20),
+    (1 << 20) + 1,
+    3 * (1 << 20) + 17
+  };
+
 // enums
   enum class Mode {
     Digest,
@@ -99,10 +110,16 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
                   uint64_t output_length, std::ostream& outstream,
                   uint32_t hash_size);
 
+  void hashBuffer(Mode mode, HashAlgorithm algot,
+                  const uint8_t* data, size_t len, uint64_t seed,
+                  uint64_t output_length, std::ostream& outstream,
+                  uint32_t hash_size);
+
   void hashAnything(Mode mode, HashAlgorithm algot,
                     const std::string& inpath, std::ostream& outstream,
                     uint32_t size, bool use_test_vectors,
-                    uint64_t seed, uint64_t output_length);
+                    uint64_t seed, uint64_t output_length,
+                    bool tree = false);
 
   std::string generate_filename(const std::string& filename);
 
@@ -171,6 +188,39 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
     return st.st_size;
   }
 
+// Feed exactly `length` bytes of `in` to an incremental hash state, CHUNK_SIZE at a time
+  template <typename State>
+  static void updateFromStream(State& state, std::istream& in, uint64_t length) {
+    std::array<uint8_t, CHUNK_SIZE> chunk;
+    while (length > 0) {
+      size_t want = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, length));
+      in.read(reinterpret_cast<char*>(chunk.data()), want);
+      if (static_cast<size_t>(in.gcount()) != want) {
+        throw std::runtime_error("Input ended before its expected length.");
+      }
+      state.update(chunk.data(), want);
+      length -= want;
+    }
+  }
+
+// Digest of a file. Regular files are mmap'd and hashed in one pass straight from the page
+// cache (no copies, constant heap); the length both hashes mix into their initial state is
+// the mapping's size. Pipes and devices are read whole instead (see MappedFile).
+  void digestFile(HashAlgorithm algot, const std::string& path, uint64_t seed, uint32_t hash_size, uint8_t* out) {
+    const MappedFile file(path);
+    if (algot == HashAlgorithm::Rainbow) {
+      auto state = rainbow::HashState<bswap>::initialize(seed, file.size(), hash_size);
+      state.update(file.data(), file.size());
+      state.finalize(out);
+    } else if (algot == HashAlgorithm::Rainstorm) {
+      auto state = rainstorm::HashState<bswap>::initialize(seed, file.size(), hash_size);
+      state.update(file.data(), file.size());
+      state.finalize(out);
+    } else {
+      throw std::runtime_error("Invalid algorithm for digestFile");
+    }
+  }
+
 #ifdef USE_FILESYSTEM
   std::string generate_filename(const std::string& filename) {
     std::filesystem::path p{filename};
@@ -248,24 +298,80 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
 // HMAC
   static const size_t HMAC_SIZE = 32; // 256 bits for Rainstorm
 
+  // Incremental form of the tag: Rainstorm-256 (seed 0) of message || key, where the
+  // message is headerData || ciphertext. Rainstorm mixes the total length into its initial
+  // state, so the message length is declared up front; update() then takes the message in
+  // pieces of any size, straight from wherever they already are, and final() appends the key.
+  class HmacContext {
+  public:
+    HmacContext(const std::vector<uint8_t> &key, uint64_t messageLen)
+      : key_(key), remaining_(messageLen),
+        state_(rainstorm::HashState<false>::initialize(0, messageLen + key.size(), HMAC_SIZE * 8)) {}
+
+    void update(const uint8_t *data, size_t len) {
+      if (len > remaining_) {
+        throw std::runtime_error("HMAC input is longer than its declared length.");
+      }
+      state_.update(data, len);
+      remaining_ -= len;
+    }
+
+    void update(const std::vector<uint8_t> &data) {
+      update(data.data(), data.size());
+    }
+
+    // Message bytes still expected before final()
+    uint64_t remaining() const { return remaining_; }
+
+    std::vector<uint8_t> final() {
+      if (remaining_ != 0) {
+        throw std::runtime_error("HMAC input is shorter than its declared length.");
+      }
+      state_.update(key_.data(), key_.size());
+      std::vector<uint8_t> hmac(HMAC_SIZE);
+      state_.finalize(hmac.data());
+      return hmac;
+    }
+
+  private:
+    std::vector<uint8_t> key_;
+    uint64_t remaining_;
+    rainstorm::HashState<false> state_;
+  };
+
   std::vector<uint8_t> createHMAC(
     const std::vector<uint8_t> &headerData,
     const std::vector<uint8_t> &ciphertext,
     const std::vector<uint8_t> &key
   ) {
-    // 1) Create a buffer for the concatenation
-    std::vector<uint8_t> buffer;
-    buffer.reserve(headerData.size() + ciphertext.size() + key.size());
+    HmacContext mac(key, headerData.size() + ciphertext.size());
+    mac.update(headerData);
+    mac.update(ciphertext);
+    return mac.final();
+  }
 
-    // 2) Concatenate header data, ciphertext, and key
-    buffer.insert(buffer.end(), headerData.begin(), headerData.end());
-    buffer.insert(buffer.end(), ciphertext.begin(), ciphertext.end());
-    buffer.insert(buffer.end(), key.begin(), key.end());
+  // Same tag as above, but the ciphertext is streamed from `in` (cipherLen bytes from its
+  // current position) in CHUNK_SIZE pieces instead of being held in memory
+  std::vector<uint8_t> createHMAC(
+    const std::vector<uint8_t> &headerData,
+    std::istream &in,
+    uint64_t cipherLen,
+    const std::vector<uint8_t> &key
+  ) {
+    HmacContext mac(key, headerData.size() + cipherLen);
+    mac.update(headerData);
+    updateFromStream(mac, in, cipherLen);
+    return mac.final();
+  }
 
-    // 3) Hash the concatenated buffer
-    std::vector<uint8_t> hmac(HMAC_SIZE);
-    rainstorm::rainstorm<256, false>(buffer.data(), buffer.size(), 0, hmac.data());
-    return hmac;
+  // Constant-time tag comparison
+  bool hmacEqual(const std::vector<uint8_t> &computedHMAC, const std::vector<uint8_t> &hmacToCheck) {
+    if (computedHMAC.size() != hmacToCheck.size()) return false;
+    bool equal = true;
+    for (size_t i = 0; i < computedHMAC.size(); i++) {
+      if (computedHMAC[i] != hmacToCheck[i]) equal = false;
+    }
+    return equal;
   }
 
   bool verifyHMAC(
@@ -278,12 +384,7 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
     auto computedHMAC = createHMAC(headerData, ciphertext, key);
 
     // Compare with the provided HMAC (constant-time comparison)
-    if (computedHMAC.size() != hmacToCheck.size()) return false;
-    bool equal = true;
-    for (size_t i = 0; i < computedHMAC.size(); i++) {
-      if (computedHMAC[i] != hmacToCheck[i]) equal = false;
-    }
-    return equal;
+    return hmacEqual(computedHMAC, hmacToCheck);
   }
 
 // ------------------------------------------------------------------
@@ -370,43 +471,154 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
     }
   }
 
+  // Apply a --kernel choice: "auto" keeps the cpuid pick, anything else must be supported here
+  void selectSimdKernel(const std::string& name) {
+    SimdKernel kernel;
+    if (name == "auto") {
+      kernel = detectSimdKernel();
+    } else if (name == "scalar") {
+      kernel = SimdKernel::Scalar;
+    } else if (name == "avx2") {
+      kernel = SimdKernel::AVX2;
+    } else if (name == "avx512") {
+      kernel = SimdKernel::AVX512;
+    } else {
+      throw std::runtime_error("Invalid kernel: " + name + " (must be auto, scalar, avx2 or avx512)");
+    }
+    if (!simdKernelSupported(kernel)) {
+      throw std::runtime_error("Kernel " + name + " is not supported on this CPU");
+    }
+    activeSimdKernel() = kernel;
+  }
+
+// hash engine
+  // (algorithm, bits) resolved once to a plain function pointer. Hot loops carry the engine
+  // and call it with raw pointers instead of going through invokeHash's switches per call.
+  struct HashEngine {
+    typedef void (*HashFn)(const void* in, const size_t len, const seed_t seed, void* out);
+
+    HashAlgorithm algot = HashAlgorithm::Unknown;
+    uint32_t bits = 0;
+    HashFn fn = nullptr;
+
+    size_t size() const { return bits / 8; }
+
+    void operator()(const void* in, size_t len, uint64_t seed, void* out) const {
+      fn(in, len, seed, out);
+    }
+
+    template<bool bswap>
+    static HashEngine resolve(HashAlgorithm algot, uint32_t bits) {
+      struct Entry { HashAlgorithm algot; uint32_t bits; HashFn fn; };
+      static constexpr Entry table[] = {
+        { HashAlgorithm::Rainbow,   64,  rainbow::rainbow<64, bswap> },
+        { HashAlgorithm::Rainbow,   128, rainbow::rainbow<128, bswap> },
+        { HashAlgorithm::Rainbow,   256, rainbow::rainbow<256, bswap> },
+        { HashAlgorithm::Rainstorm, 64,  rainstorm::rainstorm<64, bswap> },
+        { HashAlgorithm::Rainstorm, 128, rainstorm::rainstorm<128, bswap> },
+        { HashAlgorithm::Rainstorm, 256, rainstorm::rainstorm<256, bswap> },
+        { HashAlgorithm::Rainstorm, 512, rainstorm::rainstorm<512, bswap> },
+      };
+
+      for (const Entry& entry : table) {
+        if (entry.algot == algot && entry.bits == bits) {
+          return HashEngine{ algot, bits, entry.fn };
+        }
+      }
+
+      if (algot == HashAlgorithm::Rainbow) {
+        throw std::runtime_error("Invalid hash_size for rainbow");
+      } else if (algot == HashAlgorithm::Rainstorm) {
+        throw std::runtime_error("Invalid hash_size for rainstorm");
+      }
+      throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
+    }
+  };
+
+  // Hashes prefix || suffix for many suffixes of one fixed length, e.g. subkey || nonce in the
+  // puzzle search. The prefix is absorbed once into a midstate and each call only absorbs the
+  // suffix and finalizes; the result is identical to engine(prefix || suffix).
+  class PrefixHasher {
+  public:
+    PrefixHasher(const HashEngine& engine, const uint8_t* prefix, size_t prefixLen,
+                 size_t suffixLen, uint64_t seed)
+      : algot(engine.algot), suffixLen(suffixLen) {
+      const size_t totalLen = prefixLen + suffixLen;
+      if (algot == HashAlgorithm::Rainstorm) {
+        storm = StormMidstate::capture(prefix, prefixLen, totalLen, seed, engine.bits);
+      } else {
+        bow = BowMidstate::capture(prefix, prefixLen, totalLen, seed, engine.bits);
+      }
+    }
+
+    void operator()(const uint8_t* suffix, uint8_t* out) const {
+      if (algot == HashAlgorithm::Rainstorm) {
+        storm.resume(suffix, suffixLen, out);
+      } else {
+        bow.resume(suffix, suffixLen, out);
+      }
+    }
+
+  private:
+    typedef HashMidstate<rainstorm::HashState<bswap>> StormMidstate;
+    typedef HashMidstate<rainbow::HashState<bswap>> BowMidstate;
+
+    HashAlgorithm algot;
+    size_t suffixLen;
+    StormMidstate storm;
+    BowMidstate bow;
+  };
+
 // hash helper
   template<bool bswap>
   void invokeHash(HashAlgorithm algot, uint64_t seed, std::vector<uint8_t>& buffer,
                   std::vector<uint8_t>& temp_out, int hash_size) {
-    if (algot == HashAlgorithm::Rainbow) {
-      switch(hash_size) {
-        case 64:
-          rainbow::rainbow<64, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        case 128:
-          rainbow::rainbow<128, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        case 256:
-          rainbow::rainbow<256, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        default:
-          throw std::runtime_error("Invalid hash_size for rainbow");
-      }
-    } else if (algot == HashAlgorithm::Rainstorm) {
-      switch(hash_size) {
-        case 64:
-          rainstorm::rainstorm<64, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        case 128:
-          rainstorm::rainstorm<128, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        case 256:
-          rainstorm::rainstorm<256, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        case 512:
-          rainstorm::rainstorm<512, bswap>(buffer.data(), buffer.size(), seed, temp_out.data());
-          break;
-        default:
-          throw std::runtime_error("Invalid hash_size for rainstorm");
+    HashEngine::resolve<bswap>(algot, hash_size)(buffer.data(), buffer.size(), seed, temp_out.data());
+  }
+
+  // Batch form: hashes every buffer with the same algorithm and size into the matching
+  // temp_outs entry. When all buffers share one length, rainstorm batches run through the
+  // multi-buffer kernel (rainstorm::rainstorm_xN); anything else falls back to one call each.
+  template<bool bswap>
+  void invokeHash(HashAlgorithm algot, uint64_t seed, std::vector<std::vector<uint8_t>>& buffers,
+                  std::vector<std::vector<uint8_t>>& temp_outs, int hash_size) {
+    if (buffers.size() != temp_outs.size()) {
+      throw std::runtime_error("invokeHash batch: buffers and outputs differ in count");
+    }
+    bool sameLength = std::all_of(buffers.begin(), buffers.end(), [&](const std::vector<uint8_t>& b) {
+      return b.size() == buffers.front().size();
+    });
+
+    if (algot != HashAlgorithm::Rainstorm || !sameLength || buffers.size() < 2) {
+      for (size_t i = 0; i < buffers.size(); i++) {
+        invokeHash<bswap>(algot, seed, buffers[i], temp_outs[i], hash_size);
       }
-    } else {
-      throw std::runtime_error("Invalid algorithm: " + hashAlgoToString(algot));
+      return;
+    }
+
+    std::vector<const void*> in(buffers.size());
+    std::vector<void*> out(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+      in[i] = buffers[i].data();
+      out[i] = temp_outs[i].data();
+    }
+    size_t len = buffers.front().size();
+
+    switch(hash_size) {
+      case 64:
+        rainstorm::rainstorm_xN<64, bswap>(in.data(), len, seed, out.data(), in.size());
+        break;
+      case 128:
+        rainstorm::rainstorm_xN<128, bswap>(in.data(), len, seed, out.data(), in.size());
+        break;
+      case 256:
+        rainstorm::rainstorm_xN<256, bswap>(in.data(), len, seed, out.data(), in.size());
+        break;
+      case 512:
+        rainstorm::rainstorm_xN<512, bswap>(in.data(), len, seed, out.data(), in.size());
+        break;
+      default:
+        throw std::runtime_error("Invalid hash_size for rainstorm");
     }
   }
 
@@ -510,7 +722,10 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
   void mineNonceRand(HashAlgorithm algot, uint64_t seed, uint32_t hash_size,
                      const std::vector<uint8_t>& prefix_bytes,
                      const std::string& baseInput) {
-    std::vector<uint8_t> hash_output(hash_size / 8);
+    // Every trial has the same length, so trials are hashed a batch at a time
+    const size_t batchSize = 8;
+    std::vector<std::vector<uint8_t>> buffers(batchSize);
+    std::vector<std::vector<uint8_t>> hash_outputs(batchSize, std::vector<uint8_t>(hash_size / 8));
     uint64_t iterationCount = 0;
 
     RandomFunc randomFunc = selectRandomFunc(RandomConfig::entropyMode);
@@ -519,29 +734,33 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
     auto start_time = std::chrono::steady_clock::now();
 
     while (true) {
-      iterationCount++;
-
       // Build input = baseInput + random bytes
-      std::vector<uint8_t> buffer(baseInput.begin(), baseInput.end());
-      std::vector<uint8_t> random = rng.as<uint8_t>(16);
-      buffer.insert(buffer.end(), random.begin(), random.end());
+      for (auto& buffer : buffers) {
+        buffer.assign(baseInput.begin(), baseInput.end());
+        std::vector<uint8_t> random = rng.as<uint8_t>(16);
+        buffer.insert(buffer.end(), random.begin(), random.end());
+      }
 
-      invokeHash<bswap>(algot, seed, buffer, hash_output, hash_size);
+      invokeHash<bswap>(algot, seed, buffers, hash_outputs, hash_size);
 
-      if (hasPrefix(hash_output, prefix_bytes)) {
-        auto end_time = std::chrono::steady_clock::now();
-        double elapsed = std::chrono::duration<double>(end_time - start_time).count();
-        double hps = iterationCount / elapsed;
+      for (const auto& hash_output : hash_outputs) {
+        iterationCount++;
 
-        std::cerr << "\n[mineNonceRand] Found after " << iterationCount
-                  << " iterations, ~" << hps << " H/s\n";
+        if (hasPrefix(hash_output, prefix_bytes)) {
+          auto end_time = std::chrono::steady_clock::now();
+          double elapsed = std::chrono::duration<double>(end_time - start_time).count();
+          double hps = iterationCount / elapsed;
 
-        std::cout << "Final Hash: ";
-        for (auto b : hash_output) {
-          std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(b);
+          std::cerr << "\n[mineNonceRand] Found after " << iterationCount
+                    << " iterations, ~" << hps << " H/s\n";
+
+          std::cout << "Final Hash: ";
+          for (auto b : hash_output) {
+            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(b);
+          }
+          std::cout << std::dec << "\n";
+          return;
         }
-        std::cout << std::dec << "\n";
-        return;
       }
 
       if (iterationCount % 1000 == 0) {
@@ -560,19 +779,29 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
   void hashBuffer(Mode mode, HashAlgorithm algot, std::vector<uint8_t>& buffer,
                   uint64_t seed, uint64_t output_length, std::ostream& outstream,
                   uint32_t hash_size) {
+    hashBuffer(mode, algot, buffer.data(), buffer.size(), seed, output_length, outstream, hash_size);
+  }
+
+  // Pointer form: the input (e.g. a mapped file) is hashed in place, never copied
+  void hashBuffer(Mode mode, HashAlgorithm algot, const uint8_t* data, size_t len,
+                  uint64_t seed, uint64_t output_length, std::ostream& outstream,
+                  uint32_t hash_size) {
+    const HashEngine engine = HashEngine::resolve<bswap>(algot, hash_size);
     int byte_size = hash_size / 8;
     std::vector<uint8_t> temp_out(byte_size);
 
     if (mode == Mode::Digest) {
-      invokeHash<bswap>(algot, seed, buffer, temp_out, hash_size);
+      engine(data, len, seed, temp_out.data());
 
       for (const auto& byte : temp_out) {
         outstream << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
       }
     }
     else if (mode == Mode::Stream) {
+      // After the first hash, each round hashes the output of the last one
+      std::vector<uint8_t> feedback;
       while (output_length > 0) {
-        invokeHash<bswap>(algot, seed, buffer, temp_out, hash_size);
+        engine(data, len, seed, temp_out.data());
 
         uint64_t chunk_size = std::min(output_length, (uint64_t)byte_size);
         outstream.write(reinterpret_cast<const char*>(temp_out.data()), chunk_size);
@@ -582,44 +811,221 @@ std::string RandomConfig::entropyMode = "default"; // Default initialization
           break;
         }
 
-        // Update buffer with the output of the last hash operation
-        buffer.assign(temp_out.begin(), temp_out.begin() + chunk_size);
+        feedback.assign(temp_out.begin(), temp_out.begin() + chunk_size);
+        data = feedback.data();
+        len = feedback.size();
+      }
+    }
+  }
+
+// ------------------------------------------------------------------
+// Tree digest (RainTree v1)
+//   leaf i:  H(0x00 || LE64(i) || leaf bytes)          1 MiB leaves, the last may be short
+//   node:    H(0x01 || left || right)                  an odd node out moves up unchanged
+//   root:    H(0x02 || "RainTree" || version || LE64(leaf size) || LE64(total length) || top)
+// Every H is the selected algorithm, size and seed. Empty input is one empty leaf.
+// ------------------------------------------------------------------
+  static constexpr uint8_t TREE_VERSION = 1;
+  static constexpr size_t TREE_LEAF_SIZE = 1 << 20;
+  static constexpr size_t TREE_LEAF_PREFIX = 9;
+
+  static void putLE64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      out.push_back(static_cast<uint8_t>((value >> (i * 8)) & 0xFF));
+    }
+  }
+
+  // Leaf i hashed in place: only the 9-byte prefix is staged, the leaf bytes are read where they lie
+  static void treeLeafDigest(HashAlgorithm algot, uint64_t seed, uint32_t hash_size, uint64_t index,
+                             const uint8_t* leaf, size_t len, uint8_t* out) {
+    uint8_t prefix[TREE_LEAF_PREFIX] = { 0x00 };
+    for (int i = 0; i < 8; ++i) {
+      prefix[1 + i] = static_cast<uint8_t>((index >> (i * 8)) & 0xFF);
+    }
+    if (algot == HashAlgorithm::Rainbow) {
+      auto state = rainbow::HashState<bswap>::initialize(seed, TREE_LEAF_PREFIX + len, hash_size);
+      state.update(prefix, sizeof(prefix));
+      state.update(leaf, len);
+      state.finalize(out);
+    } else {
+      auto state = rainstorm::HashState<bswap>::initialize(seed, TREE_LEAF_PREFIX + len, hash_size);
+      state.update(prefix, sizeof(prefix));
+      state.update(leaf, len);
+      state.finalize(out);
+    }
+  }
+
+  // Combine the leaf digests (concatenated in leaf order) into the root
+  static std::vector<uint8_t> treeRoot(HashAlgorithm algot, uint64_t seed, uint32_t hash_size,
+                                       std::vector<uint8_t>& level, uint64_t totalLen) {
+    const size_t digestSize = hash_size / 8;
+    std::vector<uint8_t> node;
+    std::vector<uint8_t> nodeOut(digestSize);
+    while (level.size() > digestSize) {
+      size_t count = level.size() / digestSize;
+      std::vector<uint8_t> next;
+      next.reserve(((count + 1) / 2) * digestSize);
+      for (size_t i = 0; i + 1 < count; i += 2) {
+        node.assign(1, 0x01);
+        node.insert(node.end(), level.begin() + i * digestSize, level.begin() + (i + 2) * digestSize);
+        invokeHash<bswap>(algot, seed, node, nodeOut, hash_size);
+        next.insert(next.end(), nodeOut.begin(), nodeOut.end());
+      }
+      if (count % 2 == 1) {
+        next.insert(next.end(), level.end() - digestSize, level.end());
+      }
+      level.swap(next);
+    }
+
+    static const std::string TREE_TAG = "RainTree";
+    node.assign(1, 0x02);
+    node.insert(node.end(), TREE_TAG.begin(), TREE_TAG.end());
+    node.push_back(TREE_VERSION);
+    putLE64(node, TREE_LEAF_SIZE);
+    putLE64(node, totalLen);
+    node.insert(node.end(), level.begin(), level.end());
+
+    std::vector<uint8_t> root(digestSize);
+    invokeHash<bswap>(algot, seed, node, root, hash_size);
+    return root;
+  }
+
+  std::vector<uint8_t> treeDigest(HashAlgorithm algot, uint64_t seed, uint32_t hash_size, std::istream& in) {
+    const size_t digestSize = hash_size / 8;
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    // Leaves are read a batch at a time so memory stays at a few leaves per thread
+    const size_t batchLeaves = static_cast<size_t>(threads) * 4;
+    std::vector<std::vector<uint8_t>> leaves(batchLeaves);
+    std::vector<std::vector<uint8_t>> leafDigests(batchLeaves, std::vector<uint8_t>(digestSize));
+    for (auto& leaf : leaves) {
+      leaf.reserve(TREE_LEAF_PREFIX + TREE_LEAF_SIZE);
+    }
+
+    std::vector<uint8_t> level;
+    uint64_t leafIndex = 0;
+    uint64_t totalLen = 0;
+    bool done = false;
+
+    while (!done) {
+      size_t filled = 0;
+      while (filled < batchLeaves) {
+        std::vector<uint8_t>& leaf = leaves[filled];
+        leaf.clear();
+        leaf.push_back(0x00);
+        putLE64(leaf, leafIndex);
+        leaf.resize(TREE_LEAF_PREFIX + TREE_LEAF_SIZE);
+        in.read(reinterpret_cast<char*>(leaf.data() + TREE_LEAF_PREFIX), TREE_LEAF_SIZE);
+        size_t got = static_cast<size_t>(in.gcount());
+        leaf.resize(TREE_LEAF_PREFIX + got);
+
+        if (got < TREE_LEAF_SIZE) {
+          done = true;
+          // A short read ends the input; keep it as a leaf unless it is an empty tail
+          if (got == 0 && leafIndex > 0) break;
+        }
+        totalLen += got;
+        ++leafIndex;
+        ++filled;
+        if (done) break;
+      }
+
+      #pragma omp parallel for schedule(dynamic, 1)
+      for (size_t i = 0; i < filled; ++i) {
+        invokeHash<bswap>(algot, seed, leaves[i], leafDigests[i], hash_size);
+      }
+
+      for (size_t i = 0; i < filled; ++i) {
+        level.insert(level.end(), leafDigests[i].begin(), leafDigests[i].end());
       }
     }
+
+    return treeRoot(algot, seed, hash_size, level, totalLen);
+  }
+
+  // Mapped form: every leaf is hashed in parallel straight from `data` (e.g. a MappedFile)
+  std::vector<uint8_t> treeDigest(HashAlgorithm algot, uint64_t seed, uint32_t hash_size,
+                                  const uint8_t* data, size_t len) {
+    HashEngine::resolve<bswap>(algot, hash_size); // Reject a bad algorithm or size before the parallel loop
+    const size_t digestSize = hash_size / 8;
+    const size_t leafCount = len == 0 ? 1 : (len + TREE_LEAF_SIZE - 1) / TREE_LEAF_SIZE;
+    std::vector<uint8_t> level(leafCount * digestSize);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < leafCount; ++i) {
+      const size_t offset = i * TREE_LEAF_SIZE;
+      treeLeafDigest(algot, seed, hash_size, i, data + offset, std::min(TREE_LEAF_SIZE, len - offset),
+                     level.data() + i * digestSize);
+    }
+
+    return treeRoot(algot, seed, hash_size, level, len);
+  }
+
+  static void writeHex(std::ostream& outstream, const std::vector<uint8_t>& bytes) {
+    for (const auto& byte : bytes) {
+      outstream << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+    }
+    outstream << std::dec;
   }
 
 void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
                   std::ostream& outstream, uint32_t size, bool use_test_vectors,
-                  uint64_t seed, uint64_t output_length) {
+                  uint64_t seed, uint64_t output_length, bool tree) {
 
   // If using test vectors, process each one and print the hash.
   if (use_test_vectors) {
     for (const auto& test_vector : test_vectors) {
-      std::vector<uint8_t> buffer(test_vector.begin(), test_vector.end());
-      hashBuffer(mode, algot, buffer, seed, output_length, outstream, size);
+      if (tree) {
+        std::istringstream in(test_vector);
+        writeHex(outstream, treeDigest(algot, seed, size, in));
+      } else {
+        std::vector<uint8_t> buffer(test_vector.begin(), test_vector.end());
+        hashBuffer(mode, algot, buffer, seed, output_length, outstream, size);
+      }
       outstream << ' ' << '"' << test_vector << '"' << '\n';
     }
+    if (tree) {
+      for (size_t len : tree_test_lengths) {
+        std::string pattern(len, '\0');
+        for (size_t i = 0; i < len; ++i) {
+          pattern[i] = static_cast<char>((i * 7 + 3) & 0xFF);
+        }
+        std::istringstream in(pattern);
+        writeHex(outstream, treeDigest(algot, seed, size, in));
+        outstream << ' ' << '"' << "<" << len << " patterned bytes>" << '"' << '\n';
+      }
+    }
+  } else if (tree) {
+    if (!inpath.empty()) {
+      // Leaves hash in place out of the mapping, all of them in parallel
+      const MappedFile input(inpath);
+      writeHex(outstream, treeDigest(algot, seed, size, input.data(), input.size()));
+    } else {
+      writeHex(outstream, treeDigest(algot, seed, size, getInputStream()));
+    }
+    outstream << ' ' << (inpath.empty() ? "stdin" : inpath) << '\n';
+  } else if (mode == Mode::Digest && !inpath.empty()) {
+    // Digest files straight from an mmap
+    std::vector<uint8_t> digest(size / 8);
+    digestFile(algot, inpath, seed, size, digest.data());
+    writeHex(outstream, digest);
+    outstream << ' ' << inpath << '\n';
   } else {
-    std::vector<uint8_t> buffer;
     if (!inpath.empty()) {
-      // Open the file and read its entire contents into buffer.
-      std::ifstream infile(inpath, std::ios::binary);
-      if (!infile) {
-        throw std::runtime_error("Cannot open file for reading: " + inpath);
-      }
-      buffer = std::vector<uint8_t>((std::istreambuf_iterator<char>(infile)),
-                                    std::istreambuf_iterator<char>());
-      infile.close();
+      // Hash straight out of the mapping
+      const MappedFile input(inpath);
+      hashBuffer(mode, algot, input.data(), input.size(), seed, output_length, outstream, size);
     }
     else {
       // Read from stdin (using getInputStream() helper).
       std::istream& in_stream = getInputStream();
-      buffer = std::vector<uint8_t>((std::istreambuf_iterator<char>(in_stream)),
-                                    std::istreambuf_iterator<char>());
+      std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(in_stream)),
+                                  std::istreambuf_iterator<char>());
+      hashBuffer(mode, algot, buffer, seed, output_length, outstream, size);
     }
-
-    // Process the complete input buffer.
-    hashBuffer(mode, algot, buffer, seed, output_length, outstream, size);
     outstream << ' ' << (inpath.empty() ? "stdin" : inpath) << '\n';
   }
 }
@@ -657,14 +1063,14 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
 #endif
 
 // Compress using zlib
-  std::vector<uint8_t> compressData(const std::vector<uint8_t>& data) {
+  std::vector<uint8_t> compressData(const uint8_t* data, size_t size) {
     z_stream zs = {};
     if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK) {
       throw std::runtime_error("Failed to initialize zlib deflate.");
     }
 
-    zs.next_in = const_cast<Bytef*>(data.data());
-    zs.avail_in = data.size();
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.avail_in = size;
 
     std::vector<uint8_t> compressed;
     uint8_t buffer[1024];
@@ -685,6 +1091,10 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
     return compressed;
   }
 
+  std::vector<uint8_t> compressData(const std::vector<uint8_t>& data) {
+    return compressData(data.data(), data.size());
+  }
+
 // Decompress using zlib
   std::vector<uint8_t> decompressData(const std::vector<uint8_t>& data) {
     z_stream zs = {};
@@ -717,6 +1127,32 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
     return decompressed;
   }
 
+// Inflate one zlib stream into out[0, capacity), throwing as soon as it would produce more.
+// Returns the decompressed size. For frames not yet authenticated: memory stays at capacity
+// however far a forged stream would expand.
+  size_t decompressInto(const uint8_t* data, size_t size, uint8_t* out, size_t capacity) {
+    z_stream zs = {};
+    if (inflateInit(&zs) != Z_OK) {
+      throw std::runtime_error("Failed to initialize zlib inflate.");
+    }
+
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.avail_in = static_cast<uInt>(size);
+    zs.next_out = out;
+    zs.avail_out = static_cast<uInt>(capacity);
+
+    int ret = inflate(&zs, Z_FINISH);
+    const size_t produced = zs.total_out;
+    inflateEnd(&zs);
+    if (ret == Z_STREAM_END) {
+      return produced;
+    }
+    if (zs.avail_out == 0) {
+      throw std::runtime_error("zlib stream does not end within the expected size.");
+    }
+    throw std::runtime_error("zlib decompression failed.");
+  }
+
 // usage
   void usage() {
     std::cout << "Usage: rainsum [OPTIONS] [INFILE]\n"
@@ -729,8 +1165,15 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
               << "  -s, --size [64-256|64-512]        Specify the bit size of the hash. Default: 256\n"
               << "  -o, --output-file FILE            Output file for the hash or stream\n"
               << "  -t, --test-vectors                Calculate the hash of the standard test vectors\n"
+              << "  --keystream [kdf|xof]             Stream-enc keystream profile: kdf (8 rounds per block, default) or xof (4)\n"
+              << "  --threads N                       Stream-enc worker threads (0 = one per core, default)\n"
+              << "  --no-index                        Stream-enc: omit the segment index used by dec --range\n"
+              << "  --range A-B                       Dec: decrypt only plaintext bytes A-B of an indexed stream file\n"
+              << "  --bench [--bench-format table|json]  Benchmark every hash (or just -a / -s) and exit\n"
+              << "  --tree                            Digest mode: parallel tree hash over 1 MiB leaves (RainTree v1)\n"
               << "  -l, --output-length HASHES        Set the output length in hash iterations (stream only)\n"
-              << "  -v, --version                     Print out the version\n"
+              << "  -v, --version                     Print out the version and the selected hash kernel\n"
+              << "  --kernel [auto|scalar|avx2|avx512]  Force a SIMD kernel instead of the cpuid choice\n"
               << "  --seed                            Seed value (64-bit number or string). If string is used,\n"
               << "                                    it is hashed with Rainstorm to a 64-bit number\n"
               << "  --mine-mode [chain|nonceInc|nonceRand]   Perform 'mining' tasks until prefix is matched\n"
@@ -744,14 +1187,37 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
   static const int XOF_ITERATIONS = 4;
   static const int DE_ITERATIONS = 1;
 
+  // How stream-enc expands the PRK into keystream, stored in FileHeader::keystreamProfile.
+  // The PRK itself always takes KDF_ITERATIONS rounds; Xof only shortens the per-block
+  // chain, making keystream generation about twice as fast.
+  enum class KeystreamProfile : uint8_t {
+    Kdf = 0x00, // KDF_ITERATIONS hashes per block (every file before header v0x03)
+    Xof = 0x01  // XOF_ITERATIONS hashes per block
+  };
+
+  static KeystreamProfile getKeystreamProfile(const std::string& name) {
+    if (name == "kdf") return KeystreamProfile::Kdf;
+    if (name == "xof") return KeystreamProfile::Xof;
+    throw std::runtime_error("Invalid keystream profile: " + name + " (must be kdf or xof)");
+  }
+
+  static int keystreamIterations(uint8_t profile) {
+    switch (static_cast<KeystreamProfile>(profile)) {
+      case KeystreamProfile::Kdf: return KDF_ITERATIONS;
+      case KeystreamProfile::Xof: return XOF_ITERATIONS;
+    }
+    throw std::runtime_error("Unsupported keystream profile: " + std::to_string(profile));
+  }
+
   static std::vector<uint8_t> derivePRK(
     const std::vector<uint8_t> &seed,
     const std::vector<uint8_t> &salt,
     const std::vector<uint8_t> &ikm,
-    HashAlgorithm algot,
-    uint32_t hash_bits,
+    const HashEngine &engine,
     bool debug = false
   ) {
+    const uint32_t hash_bits = engine.bits;
+
     // Combine salt || ikm || info
     std::vector<uint8_t> combined;
     combined.reserve(salt.size() + ikm.size() + KDF_INFO_STRING.size());
@@ -783,9 +1249,9 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
     // Iterate the hash function KDF_ITERATIONS times
     for (int i = 0; i < KDF_ITERATIONS; ++i) {
       // Call your hashing function
-      invokeHash<bswap>(algot, seed_num, temp, prk, hash_bits);
+      engine(temp.data(), temp.size(), seed_num, prk.data());
 
-      // prk is now the result of invokeHash
+      // prk is now the result of the hash
       temp = prk; // Next iteration takes the output of the previous
 
       if (debug) {
@@ -818,49 +1284,188 @@ void hashAnything(Mode mode, HashAlgorithm algot, const std::string& inpath,
     std::memcpy(dst, src, size); // Replace with SIMD intrinsics if beneficial
   }
 
+  // Counter blocks below this many are produced on the calling thread
+  static constexpr size_t KDF_PARALLEL_BLOCKS = 256;
+
+  // PRK || info is the same for every counter, so the first hash of each counter
+  // resumes from a midstate taken after it and only absorbs the counter bytes
+  static PrefixHasher kdfPrefixHasher(const std::vector<uint8_t>& prk, const HashEngine& engine) {
+    std::vector<uint8_t> prefix;
+    prefix.reserve(prk.size() + KDF_INFO_STRING.size());
+    prefix.insert(prefix.end(), prk.begin(), prk.end());
+    prefix.insert(prefix.end(), KDF_INFO_STRING.begin(), KDF_INFO_STRING.end());
+    return PrefixHasher(engine, prefix.data(), prefix.size(), 8, 0);
+  }
+
+  // Writes `len` bytes of the counter-mode output starting at block `firstBlock`
+  // (block n is counter n + 1), or with xorData XORs them into `out` instead. Blocks
+  // depend only on their counter, so they are independent and each one is chained in
+  // two stack buffers and applied straight to `out`; the keystream never exists as a
+  // whole. Callers already inside a parallel region (parascatter trials) stay serial.
+  static void kdfBlocks(const PrefixHasher& first, const HashEngine& engine,
+                        uint64_t firstBlock, uint8_t* out, size_t len,
+                        int iterations = KDF_ITERATIONS, bool allowParallel = true,
+                        bool xorData = false) {
+    const size_t hash_size = engine.size();
+    const size_t blocks = (len + hash_size - 1) / hash_size;
+    [[maybe_unused]] bool parallel = allowParallel && blocks >= KDF_PARALLEL_BLOCKS;
+#ifdef _OPENMP
+    parallel = parallel && !omp_in_parallel();
+#endif
+
+    #pragma omp parallel for schedule(static) if(parallel)
+    for (size_t n = 0; n < blocks; ++n) {
+      // Counter in big-endian completes PRK || info || counter
+      const uint64_t counter = firstBlock + n + 1;
+      uint8_t counterBytes[8];
+      for (int i = 7; i >= 0; --i) {
+        counterBytes[7 - i] = static_cast<uint8_t>((counter >> (i * 8)) & 0xFF);
+      }
+
+      // Perform the hash function `iterations` times
+      uint8_t kn[2][64];
+      first(counterBytes, kn[0]);
+      for (int i = 1; i < iterations; ++i) {
+        engine(kn[(i - 1) & 1], hash_size, 0, kn[i & 1]);
+      }
+
+      // Append to (or XOR into) output
+      const size_t offset = n * hash_size;
+      const size_t to_copy = std::min(hash_size, len - offset);
+      if (xorData) {
+        xorBytes(out + offset, kn[(iterations - 1) & 1], to_copy);
+      } else {
+        fast_memcpy(out + offset, kn[(iterations - 1) & 1], to_copy);
+      }
+    }
+  }
+
   static std::vector<uint8_t> extendOutputKDF(
       const std::vector<uint8_t>& prk,
       size_t totalLen,
-      HashAlgorithm algot,
-      uint32_t hash_bits) {
-    
-    const size_t hash_size = hash_bits / 8;
+      const HashEngine& engine) {
     std::vector<uint8_t> output(totalLen);
-    
-    uint64_t counter = 1;
-    std::vector<uint8_t> kn = prk; // Initial K_n = PRK
-    
-    size_t generated = 0;
-    while (generated < totalLen) {
-      // Combine PRK || info || counter
-      std::vector<uint8_t> combined;
-      combined.reserve(prk.size() + KDF_INFO_STRING.size() + 8);
-      combined.insert(combined.end(), prk.begin(), prk.end());
-      combined.insert(combined.end(), KDF_INFO_STRING.begin(), KDF_INFO_STRING.end());
-      
-      // Append counter in big-endian
-      for (int i = 7; i >= 0; --i) {
-        combined.push_back(static_cast<uint8_t>((counter >> (i * 8)) & 0xFF));
-      }
+    kdfBlocks(kdfPrefixHasher(prk, engine), engine, 0, output.data(), totalLen);
+    return output;
+  }
+
+  // One puzzle trial's output, hash(trial) || extendOutputKDF(trial, extension), produced a
+  // counter block at a time as the search reads it. Most trials are settled (matched, or left
+  // with too few bytes to ever match) well before the end, so they never pay for the rest
+  // of the extension. The buffer is reused for every trial.
+  class TrialOutput {
+  public:
+    TrialOutput(const HashEngine& engine, size_t trialLen, uint32_t extension)
+      : engine(engine), trialLen(trialLen),
+        prefix(trialLen + KDF_INFO_STRING.size()), buf(engine.size() + extension) {
+      std::copy(KDF_INFO_STRING.begin(), KDF_INFO_STRING.end(), prefix.begin() + trialLen);
+    }
+
+    // Start a trial (trial = subkey || nonce). The caller writes its hash to data().
+    void begin(const uint8_t* trial) {
+      std::memcpy(prefix.data(), trial, trialLen);
+      readyLen = engine.size();
+      extensionPrefix.reset();
+    }
 
-      // Perform the hash function KDF_ITERATIONS times
-      std::vector<uint8_t> temp = combined;
-      std::vector<uint8_t> kn_next(hash_size, 0);
-      for (int i = 0; i < KDF_ITERATIONS; ++i) {
-        invokeHash<bswap>(algot, 0, temp, kn_next, hash_bits);
-        temp = kn_next;
+    uint8_t* data() { return buf.data(); }
+    const uint8_t* data() const { return buf.data(); }
+    size_t size() const { return buf.size(); }
+    size_t ready() const { return readyLen; }
+
+    // Make at least the first `n` bytes (capped at size()) valid; returns how many are
+    size_t reach(size_t n) {
+      if (n <= readyLen || readyLen == buf.size()) {
+        return readyLen;
+      }
+      if (!extensionPrefix) {
+        extensionPrefix.emplace(engine, prefix.data(), prefix.size(), 8, 0);
       }
+      // Whole counter blocks up to the one holding byte n - 1
+      const size_t blockLen = engine.size();
+      const size_t end = std::min(buf.size(), (n + blockLen - 1) / blockLen * blockLen);
+      kdfBlocks(*extensionPrefix, engine, (readyLen - blockLen) / blockLen, buf.data() + readyLen,
+                end - readyLen, KDF_ITERATIONS, false);
+      readyLen = end;
+      return readyLen;
+    }
 
-      kn = kn_next;
+  private:
+    HashEngine engine;
+    size_t trialLen;
+    std::vector<uint8_t> prefix; // trial || KDF info
+    std::vector<uint8_t> buf;
+    std::optional<PrefixHasher> extensionPrefix; // Built on the first reach() past the hash
+    size_t readyLen = 0;
+  };
 
-      // Append to output
-      size_t to_copy = std::min(hash_size, totalLen - generated);
-      fast_memcpy(output.data() + generated, kn.data(), to_copy);
-      generated += to_copy;
-      counter++;
+  // The extendOutputKDF byte stream produced on demand: any byte offset can be reached
+  // with seek(), and nothing is buffered beyond one counter block however long it runs.
+  // Whole blocks are generated and applied to the data by kdfBlocks (fused generate-and-
+  // XOR for xorInto); partial blocks at either end go through a one-block cache, so short
+  // reads such as frame lengths do not regenerate a block per call.
+  // With the Kdf profile keystream[i] equals extendOutputKDF(prk, n, engine)[i] for every n > i.
+  class Keystream {
+  public:
+    Keystream(const std::vector<uint8_t>& prk, const HashEngine& engine,
+              KeystreamProfile profile = KeystreamProfile::Kdf)
+      : engine(engine), first(kdfPrefixHasher(prk, engine)),
+        iterations(keystreamIterations(static_cast<uint8_t>(profile))) {}
+
+    void seek(uint64_t offset) { position = offset; }
+    uint64_t tell() const { return position; }
+
+    // Keep generation on the calling thread, for callers that run their own workers
+    void setParallel(bool enable) { parallel = enable; }
+
+    // Copy the next `len` keystream bytes to `out`
+    void read(uint8_t* out, size_t len) { apply(out, len, false); }
+
+    // XOR the next `len` keystream bytes into `data`
+    void xorInto(uint8_t* data, size_t len) { apply(data, len, true); }
+
+  private:
+    void apply(uint8_t* data, size_t len, bool xorData) {
+      const size_t hash_size = engine.size();
+      while (len > 0) {
+        const size_t at = static_cast<size_t>(position % hash_size);
+        if (at == 0 && len >= hash_size) {
+          // Whole blocks, fused
+          const size_t whole = len - len % hash_size;
+          kdfBlocks(first, engine, position / hash_size, data, whole, iterations, parallel, xorData);
+          data += whole;
+          len -= whole;
+          position += whole;
+          continue;
+        }
+
+        // Head or tail of a block
+        const uint64_t block = position / hash_size;
+        if (!cached || cachedBlock != block) {
+          kdfBlocks(first, engine, block, cache, hash_size, iterations, false);
+          cachedBlock = block;
+          cached = true;
+        }
+        const size_t n = std::min(len, hash_size - at);
+        if (xorData) {
+          xorBytes(data, cache + at, n);
+        } else {
+          fast_memcpy(data, cache + at, n);
+        }
+        data += n;
+        len -= n;
+        position += n;
+      }
     }
-    
-    return output;
-  }
+
+    HashEngine engine;
+    PrefixHasher first;
+    int iterations;
+    uint8_t cache[64];
+    uint64_t cachedBlock = 0;
+    bool cached = false;
+    bool parallel = true;
+    uint64_t position = 0;
+  };
 
 
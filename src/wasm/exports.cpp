@@ -112,6 +112,8 @@ extern "C" {
           ss << "\",";
           ss << "\"searchModeEnum\":\"0x" << std::hex << static_cast<int>(hdr.searchModeEnum) << "\",";
           ss << "\"originalSize\":" << std::dec << hdr.originalSize << ",";
+          ss << "\"keystreamProfile\":" << static_cast<int>(hdr.keystreamProfile) << ",";
+          ss << "\"streamFlags\":" << static_cast<int>(hdr.streamFlags) << ",";
           ss << "\"hmac\":\"";
           for (auto b : hdr.hmac) {
               ss << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(b);
@@ -491,12 +493,7 @@ extern "C" {
   EMSCRIPTEN_KEEPALIVE
   int wasmWriteHMACToBuffer(uint8_t* buffer, size_t bufferSize, const uint8_t* newHMAC) {
       try {
-          // According to PackedHeader layout:
-          // magic(4) + version(1) + cipherMode(1) + blockSize(2) +
-          // nonceSize(2) + hashSizeBits(2) + outputExtension(2) +
-          // hashNameLen(1) + iv(8) + saltLen(1) + searchModeEnum(1) + originalSize(8)
-          // = 33 bytes before the HMAC field.
-          const size_t hmac_offset = 33;
+          const size_t hmac_offset = FILE_HEADER_HMAC_OFFSET;
           const size_t HMAC_SIZE = 32;
           if (bufferSize < hmac_offset + HMAC_SIZE) {
               throw std::runtime_error("Buffer size too small in wasmWriteHMACToBuffer.");